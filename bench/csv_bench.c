@@ -0,0 +1,356 @@
+// Host benchmark of the BUS_DATA parsing: counts the bytes of memory every received message
+// touches, for parse_bus_data as it was before the span tokenizer (every bus copied field by field
+// out of the tuple with common_read_csv_item) and for the real bus_display_handle_msg (fields
+// terminated in place in the board's back buffer, the text layers pointing into it). The line
+// filter, which the old parser did not have, is measured on its own.
+//
+// Build and run from the repository root:
+//
+//   cc -O2 -fsanitize=kernel-address --param asan-instrumentation-with-call-threshold=0
+//      --param asan-stack=0 --param asan-globals=0 -DPBL_PLATFORM_BASALT -Ibench bench/csv_bench.c
+//      src/bus_display.c src/line_filter.c src/common.c -o csv_bench && ./csv_bench
+//
+// The kernel address sanitizer without its runtime turns every load and store into a call of
+// the __asan_* hooks below, which count the bytes that are not on the stack: the tuple, the
+// board's buffers and spans and the strings the text layers point at. Locals live in registers or
+// on the stack on the watch as well, so they are left out. Copies are counted by the memcpy below,
+// which replaces the one of the C library, the string compares of the line filter are not. The SDK
+// in bench/pebble.h does nothing, so setting the text of a layer costs the same in both parsers.
+//
+// "accessed" sums the size of every load and store, "distinct" counts every byte once, which is
+// the memory a message pulls through the cache. Pointers are 8 bytes on the host and 4 on the
+// watch, so loads of CsvTokens::data and ::spans are counted twice as large as they are there.
+// Use -DPBL_PLATFORM_APLITE or -DPBL_PLATFORM_EMERY for the capacities of other platforms.
+
+#include "../src/common.h"
+#include "../src/bus_display.h"
+#include "../src/bus_stop_selection.h"
+#include "../src/latency.h"
+#include "../src/line_filter.h"
+#include "../src/stats.h"
+#include "../src/stats_display.h"
+
+#define NOT_COUNTED __attribute__(( no_sanitize_address, noinline ))
+
+// the click handler of bus_display.c, which is not in its header
+void bus_display_next_page( ClickRecognizerRef recognizer, void* context );
+
+
+//==================================================================================================
+//==================================================================================================
+// Definitions
+
+// as in bus_display.c before the span tokenizer
+#define NUM_BUSES_PER_PAGE      NUM_ROWS
+#define LINE_BUFFER_SIZE         6
+#define DEST_BUFFER_SIZE        32
+#define ETA_BUFFER_SIZE          6
+
+// the stack grows down from the frame of main, so anything up to this far below it is a local
+#define STACK_RANGE             ( 8 * 1024 * 1024 )
+
+#define MAX_TOUCHED_BYTES       65536
+
+
+//==================================================================================================
+//==================================================================================================
+// Variables
+
+static struct {
+    long bytes_read;
+    long bytes_written;
+
+    // addresses of all bytes touched, sorted and deduplicated once a run is done
+    uintptr_t touched[ MAX_TOUCHED_BYTES ];
+    int num_touched;
+} s_counters;
+
+static bool s_counting = false;
+static uintptr_t s_stack_top = 0;
+
+// the tuple as it arrives in the AppMessage inbox, '\0' terminated
+static char s_tuple[ INBOX_BUS_DATA_SIZE ];
+static int s_tuple_length = 0;
+
+// the board before the span tokenizer, all buses parsed into strings
+static struct {
+    TextLayer* line;
+    TextLayer* dest;
+    TextLayer* eta;
+} s_old_bus_display_lines[ NUM_BUSES_PER_PAGE ];
+
+static GColor s_old_line_colors[ 10 ];
+static int s_old_current_page = 0;
+static int s_old_num_buses_transmitted = 0;
+
+static struct {
+    char line_string[ LINE_BUFFER_SIZE ];
+    char dest_string[ DEST_BUFFER_SIZE ];
+    char eta_string[ ETA_BUFFER_SIZE ];
+} s_old_buses[ NUM_BUSES ];
+
+
+//==================================================================================================
+//==================================================================================================
+// Counting
+
+NOT_COUNTED void count( uintptr_t address, size_t num_bytes, bool write )
+{
+    if( !s_counting || ( address < s_stack_top && address > s_stack_top - STACK_RANGE ) )
+    {
+        return;
+    }
+
+    if( write )
+    {
+        s_counters.bytes_written += num_bytes;
+    }
+    else
+    {
+        s_counters.bytes_read += num_bytes;
+    }
+
+    for( size_t i = 0; i != num_bytes && s_counters.num_touched != MAX_TOUCHED_BYTES; ++i )
+    {
+        s_counters.touched[ s_counters.num_touched++ ] = address + i;
+    }
+}
+
+NOT_COUNTED int compare_addresses( const void* a, const void* b )
+{
+    const uintptr_t lhs = *( const uintptr_t* ) a;
+    const uintptr_t rhs = *( const uintptr_t* ) b;
+    return ( lhs > rhs ) - ( lhs < rhs );
+}
+
+NOT_COUNTED int count_distinct_bytes()
+{
+    qsort( s_counters.touched, s_counters.num_touched, sizeof( uintptr_t ), compare_addresses );
+
+    int num_distinct = 0;
+
+    for( int i = 0; i != s_counters.num_touched; ++i )
+    {
+        if( i == 0 || s_counters.touched[ i ] != s_counters.touched[ i - 1 ] )
+        {
+            ++num_distinct;
+        }
+    }
+    return num_distinct;
+}
+
+#define COUNTING_HOOKS( n ) \
+    NOT_COUNTED void __asan_load##n##_noabort( void* address ) { count( ( uintptr_t ) address, n, false ); } \
+    NOT_COUNTED void __asan_store##n##_noabort( void* address ) { count( ( uintptr_t ) address, n, true ); }
+
+COUNTING_HOOKS( 1 )
+COUNTING_HOOKS( 2 )
+COUNTING_HOOKS( 4 )
+COUNTING_HOOKS( 8 )
+COUNTING_HOOKS( 16 )
+
+NOT_COUNTED void __asan_loadN_noabort( void* address, long num_bytes ) { count( ( uintptr_t ) address, num_bytes, false ); }
+NOT_COUNTED void __asan_storeN_noabort( void* address, long num_bytes ) { count( ( uintptr_t ) address, num_bytes, true ); }
+NOT_COUNTED void __asan_handle_no_return( void ) {}
+
+/**
+ * The sanitizer does not see into the library's memcpy. Copying bytewise, and not letting the
+ * compiler turn the loop back into a memcpy call, keeps this from recursing.
+ */
+NOT_COUNTED __attribute__(( optimize( "no-tree-loop-distribute-patterns" ) ))
+void* memcpy( void* target, const void* source, size_t num_bytes )
+{
+    count( ( uintptr_t ) source, num_bytes, false );
+    count( ( uintptr_t ) target, num_bytes, true );
+
+    for( size_t i = 0; i != num_bytes; ++i )
+    {
+        ( ( char* ) target )[ i ] = ( ( const char* ) source )[ i ];
+    }
+    return target;
+}
+
+
+//==================================================================================================
+//==================================================================================================
+// The other modules bus_display.c and line_filter.c call into, none of them sees the payload
+
+void latency_mark( LatencyStage stage ) {}
+void latency_format_summary( char* target, int max_bytes ) { target[ 0 ] = '\0'; }
+void latency_dump_to_log() {}
+
+void stats_increment( StatCounter counter, uint32_t amount ) {}
+void stats_display_show() {}
+void bus_stop_selection_show() {}
+
+
+//==================================================================================================
+//==================================================================================================
+// Parser before the span tokenizer, as set_bus_text_layer, get_line_color, update_bus_text_layers
+// and parse_bus_data in bus_display.c used to be
+
+void old_set_bus_text_layer( int index, const char* line, GColor line_color, const char* dest, const char* eta )
+{
+    text_layer_set_text( s_old_bus_display_lines[ index ].line, line );
+    text_layer_set_background_color( s_old_bus_display_lines[ index ].line, line_color );
+    text_layer_set_text( s_old_bus_display_lines[ index ].dest, dest );
+    text_layer_set_text( s_old_bus_display_lines[ index ].eta, eta );
+}
+
+GColor old_get_line_color( const char* line )
+{
+    if( *line == '\0' )
+    {
+        return GColorWhite;
+    }
+
+    int hash = 0;
+    char c = line[ 0 ]+13;
+    int i = 1;
+    do
+    {
+        hash += ( int ) c + 13;
+        c = line[ i ];
+        i++;
+
+    } while( c != '\0' );
+
+    while( hash > 9 )
+    {
+        int tmp = ( hash % 10 ) + ( (hash/10) % 10 ) + ( (hash/100) % 10 );
+        hash = tmp;
+    }
+    return s_old_line_colors[ hash ];
+}
+
+void old_update_bus_text_layers()
+{
+    for( int i = 0; i < NUM_BUSES_PER_PAGE; ++i )
+    {
+        int base_index = NUM_BUSES_PER_PAGE * s_old_current_page;
+        int bus_index = base_index + i;
+
+        old_set_bus_text_layer( i, s_old_buses[ bus_index ].line_string,
+                                   old_get_line_color( s_old_buses[ bus_index ].line_string ),
+                                   s_old_buses[ bus_index ].dest_string,
+                                   s_old_buses[ bus_index ].eta_string );
+    }
+}
+
+void old_parse_bus_data( const char* bus_data )
+{
+    if( *bus_data != '\0' )
+    {
+        char num_buses_string[ 8 ];
+        bus_data = common_read_csv_item( bus_data, num_buses_string, 8 );
+        s_old_num_buses_transmitted = atoi( num_buses_string );
+    }
+
+    for( int i = 0; i < NUM_BUSES; ++i )
+    {
+        if( *bus_data != '\0' ) // eof reached?
+        {
+            bus_data = common_read_csv_item( bus_data, s_old_buses[ i ].line_string, LINE_BUFFER_SIZE );
+            bus_data = common_read_csv_item( bus_data, s_old_buses[ i ].dest_string, DEST_BUFFER_SIZE );
+            bus_data = common_read_csv_item( bus_data, s_old_buses[ i ].eta_string, ETA_BUFFER_SIZE );
+        }
+        else
+        {
+            s_old_buses[ i ].line_string[ 0 ] = '\0';
+            s_old_buses[ i ].dest_string[ 0 ] = '\0';
+            s_old_buses[ i ].eta_string[ 0 ] = '\0';
+        }
+    }
+
+    old_update_bus_text_layers();
+}
+
+
+//==================================================================================================
+//==================================================================================================
+// Benchmark
+
+/**
+ * Builds a BUS_DATA payload like the phone sends it: the number of buses, then
+ * line;destination;eta of every bus.
+ */
+NOT_COUNTED void make_bus_data( int num_buses )
+{
+    static const char* lines[] = { "5", "45", "11", "25", "51", "3A", "33", "SB63", "12", "73" };
+    static const char* destinations[] = { "Aachen Bushof", "Uniklinik", "Brand", "Vaals Busstation",
+                                          "Eschweiler Bushof", "Campus Melaten", "Lintert Friedhof" };
+
+    s_tuple_length = snprintf( s_tuple, sizeof( s_tuple ), "%d", num_buses );
+
+    for( int i = 0; i != num_buses; ++i )
+    {
+        s_tuple_length += snprintf( s_tuple + s_tuple_length, sizeof( s_tuple ) - s_tuple_length, ";%s;%s;%d",
+                                    lines[ i % 10 ], destinations[ i % 7 ], 1 + i * 2 );
+    }
+}
+
+NOT_COUNTED void measure( const char* name, GenericCallback run )
+{
+    memset( &s_counters, 0, sizeof( s_counters ) );
+
+    s_counting = true;
+    run();
+    s_counting = false;
+
+    printf( "  %-24s %5ld read %5ld written %5ld accessed %5d distinct\n", name, s_counters.bytes_read,
+            s_counters.bytes_written, s_counters.bytes_read + s_counters.bytes_written, count_distinct_bytes() );
+}
+
+// the old parser read the tuple while it was still in the AppMessage inbox
+NOT_COUNTED void old_handle_bus_data()
+{
+    s_old_current_page = 0;
+    old_parse_bus_data( s_tuple );
+}
+
+NOT_COUNTED void old_next_page()
+{
+    s_old_current_page = 1;
+    old_update_bus_text_layers();
+}
+
+// the tuple is copied into the back buffer before, in place of holding the inbox
+NOT_COUNTED void handle_bus_data()
+{
+    bus_display_handle_msg( BUS_DATA, bus_display_get_bus_data_buffer(), s_tuple_length );
+}
+
+NOT_COUNTED void next_page()
+{
+    bus_display_next_page( NULL, NULL );
+}
+
+NOT_COUNTED void handle_line_filter()
+{
+    line_filter_handle_msg( BUS_DATA, s_tuple, s_tuple_length );
+}
+
+NOT_COUNTED int main()
+{
+    s_stack_top = ( uintptr_t ) __builtin_frame_address( 0 );
+
+    printf( "NUM_BUSES %d, %d buses per page\n", NUM_BUSES, NUM_BUSES_PER_PAGE );
+
+    const int num_buses[] = { 3, NUM_BUSES_PER_PAGE, NUM_BUSES };
+
+    for( int i = 0; i != 3; ++i )
+    {
+        make_bus_data( num_buses[ i ] );
+        printf( "%d buses, %d byte payload\n", num_buses[ i ], s_tuple_length );
+
+        measure( "old parse_bus_data", old_handle_bus_data );
+        measure( "old next page", old_next_page );
+
+        memcpy( bus_display_get_bus_data_buffer(), s_tuple, s_tuple_length + 1 );
+        measure( "bus_display_handle_msg", handle_bus_data );
+        measure( "bus_display_next_page", next_page );
+        measure( "line_filter_handle_msg", handle_line_filter );
+    }
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+// Just enough of the Pebble SDK to compile src/common.c, src/bus_display.c and src/line_filter.c
+// on the host for csv_bench.c. Everything in here does nothing, except the C library.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Graphics
+typedef struct { int16_t x, y; } GPoint;
+typedef struct { int16_t w, h; } GSize;
+typedef struct { GPoint origin; GSize size; } GRect;
+#define GRect( x, y, w, h ) ( ( GRect ) { { ( x ), ( y ) }, { ( w ), ( h ) } } )
+
+typedef union { uint8_t argb; } GColor;
+#define GColorClear                 ( ( GColor ) { .argb = 0x00 } )
+#define GColorBlack                 ( ( GColor ) { .argb = 0xc0 } )
+#define GColorWhite                 ( ( GColor ) { .argb = 0xff } )
+#define GColorDarkCandyAppleRed     ( ( GColor ) { .argb = 0xe0 } )
+#define GColorIslamicGreen          ( ( GColor ) { .argb = 0xc8 } )
+#define GColorMintGreen             ( ( GColor ) { .argb = 0xee } )
+#define GColorMidnightGreen         ( ( GColor ) { .argb = 0xc5 } )
+#define GColorVividCerulean         ( ( GColor ) { .argb = 0xcb } )
+#define GColorChromeYellow          ( ( GColor ) { .argb = 0xf8 } )
+#define GColorSunsetOrange          ( ( GColor ) { .argb = 0xf5 } )
+#define GColorIndigo                ( ( GColor ) { .argb = 0xd2 } )
+#define GColorBrilliantRose         ( ( GColor ) { .argb = 0xf6 } )
+#define GColorCadetBlue             ( ( GColor ) { .argb = 0xda } )
+#define GColorYellow                ( ( GColor ) { .argb = 0xfc } )
+#define PBL_IF_COLOR_ELSE( a, b )   ( a )
+
+typedef enum { GTextAlignmentLeft, GTextAlignmentCenter, GTextAlignmentRight } GTextAlignment;
+typedef enum { GCornerNone } GCornerMask;
+typedef enum { GCompOpAssign, GCompOpSet } GCompOp;
+
+typedef struct Window Window;
+typedef struct Layer Layer;
+typedef struct TextLayer TextLayer;
+typedef struct BitmapLayer BitmapLayer;
+typedef struct GBitmap GBitmap;
+typedef struct GContext GContext;
+typedef struct GFont_* GFont;
+typedef void( *LayerUpdateProc )( Layer* layer, GContext* context );
+
+static inline Window* window_create( void ) { return NULL; }
+static inline void window_destroy( Window* window ) {}
+static inline Layer* window_get_root_layer( const Window* window ) { return NULL; }
+static inline void window_stack_push( Window* window, bool animated ) {}
+static inline void layer_add_child( Layer* parent, Layer* child ) {}
+static inline void layer_set_hidden( Layer* layer, bool hidden ) {}
+static inline void layer_set_update_proc( Layer* layer, LayerUpdateProc update_proc ) {}
+
+static inline TextLayer* text_layer_create( GRect frame ) { return NULL; }
+static inline void text_layer_destroy( TextLayer* text_layer ) {}
+static inline Layer* text_layer_get_layer( TextLayer* text_layer ) { return NULL; }
+static inline void text_layer_set_text( TextLayer* text_layer, const char* text ) {}
+static inline void text_layer_set_font( TextLayer* text_layer, GFont font ) {}
+static inline void text_layer_set_text_alignment( TextLayer* text_layer, GTextAlignment alignment ) {}
+static inline void text_layer_set_background_color( TextLayer* text_layer, GColor color ) {}
+static inline void text_layer_set_text_color( TextLayer* text_layer, GColor color ) {}
+
+static inline BitmapLayer* bitmap_layer_create( GRect frame ) { return NULL; }
+static inline void bitmap_layer_destroy( BitmapLayer* bitmap_layer ) {}
+static inline Layer* bitmap_layer_get_layer( BitmapLayer* bitmap_layer ) { return NULL; }
+static inline void bitmap_layer_set_bitmap( BitmapLayer* bitmap_layer, const GBitmap* bitmap ) {}
+static inline void bitmap_layer_set_background_color( BitmapLayer* bitmap_layer, GColor color ) {}
+static inline void bitmap_layer_set_compositing_mode( BitmapLayer* bitmap_layer, GCompOp mode ) {}
+
+#define RESOURCE_ID_ICON_H 1
+
+#define FONT_KEY_GOTHIC_14          "RESOURCE_ID_GOTHIC_14"
+#define FONT_KEY_GOTHIC_14_BOLD     "RESOURCE_ID_GOTHIC_14_BOLD"
+#define FONT_KEY_GOTHIC_18_BOLD     "RESOURCE_ID_GOTHIC_18_BOLD"
+
+static inline GBitmap* gbitmap_create_with_resource( uint32_t resource_id ) { return NULL; }
+static inline void gbitmap_destroy( GBitmap* bitmap ) {}
+static inline GFont fonts_get_system_font( const char* font_key ) { return NULL; }
+
+static inline void graphics_context_set_fill_color( GContext* context, GColor color ) {}
+static inline void graphics_fill_rect( GContext* context, GRect rect, uint16_t radius, GCornerMask mask ) {}
+
+// Windows and buttons
+typedef void* ClickRecognizerRef;
+typedef void( *ClickHandler )( ClickRecognizerRef recognizer, void* context );
+typedef void( *ClickConfigProvider )( void* context );
+typedef void( *WindowHandler )( Window* window );
+typedef struct { WindowHandler load, appear, disappear, unload; } WindowHandlers;
+typedef enum { BUTTON_ID_BACK, BUTTON_ID_UP, BUTTON_ID_SELECT, BUTTON_ID_DOWN } ButtonId;
+
+static inline void window_set_window_handlers( Window* window, WindowHandlers handlers ) {}
+static inline void window_set_click_config_provider( Window* window, ClickConfigProvider provider ) {}
+static inline void window_single_click_subscribe( ButtonId button_id, ClickHandler handler ) {}
+static inline void window_long_click_subscribe( ButtonId button_id, uint16_t delay_ms, ClickHandler down_handler,
+                                                ClickHandler up_handler ) {}
+
+// App messages
+typedef struct DictionaryIterator DictionaryIterator;
+typedef enum { DICT_OK } DictionaryResult;
+
+static inline DictionaryResult dict_write_cstring( DictionaryIterator* iter, uint32_t key, const char* cstring ) { return DICT_OK; }
+
+typedef enum {
+    APP_MSG_OK,
+    APP_MSG_SEND_TIMEOUT,
+    APP_MSG_SEND_REJECTED,
+    APP_MSG_NOT_CONNECTED,
+    APP_MSG_APP_NOT_RUNNING,
+    APP_MSG_INVALID_ARGS,
+    APP_MSG_BUSY,
+    APP_MSG_BUFFER_OVERFLOW,
+    APP_MSG_ALREADY_RELEASED,
+    APP_MSG_CALLBACK_ALREADY_REGISTERED,
+    APP_MSG_CALLBACK_NOT_REGISTERED,
+    APP_MSG_OUT_OF_MEMORY,
+    APP_MSG_CLOSED,
+    APP_MSG_INTERNAL_ERROR
+} AppMessageResult;
+
+static inline uint32_t app_message_inbox_size_maximum( void ) { return 2048; }
+static inline uint32_t app_message_outbox_size_maximum( void ) { return 656; }
+
+// Logging
+typedef enum {
+    APP_LOG_LEVEL_ERROR,
+    APP_LOG_LEVEL_WARNING,
+    APP_LOG_LEVEL_INFO,
+    APP_LOG_LEVEL_DEBUG
+} AppLogLevel;
+
+#define APP_LOG( level, fmt, ... ) ( ( void ) sizeof( snprintf( NULL, 0, fmt, ## __VA_ARGS__ ) ) )
+
+// System
+static inline size_t heap_bytes_used( void ) { return 0; }
+static inline size_t heap_bytes_free( void ) { return 0; }
+static inline uint16_t time_ms( time_t* secs, uint16_t* millis ) { return 0; }
+static inline bool clock_is_24h_style( void ) { return true; }
+
+// Persistent storage
+#define PERSIST_DATA_MAX_LENGTH 256
+
+static inline bool persist_exists( uint32_t key ) { return false; }
+static inline int persist_read_data( uint32_t key, void* buffer, size_t num_bytes ) { return 0; }
+static inline int persist_write_data( uint32_t key, const void* data, size_t num_bytes ) { return 0; }
+static inline int persist_delete( uint32_t key ) { return 0; }
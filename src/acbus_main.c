@@ -1,6 +1,12 @@
 #include "common.h"
 #include "bus_display.h"
 #include "bus_stop_selection.h"
+#include "latency.h"
+#include "stats.h"
+#include "stats_display.h"
+#include "prewarm.h"
+#include "request_scheduler.h"
+#include "line_filter.h"
 
 
 //==================================================================================================
@@ -8,6 +14,11 @@
 // Definitions
 
 #define UPDATE_FREQUENCY_IN_SECS    30
+#define STATS_SAVE_INTERVAL_IN_SECS 300
+
+// Inbox back buffer sizes, large enough for the payloads compiled by the phone
+// INBOX_BUS_STOP_DATA_SIZE and INBOX_BUS_DATA_SIZE are defined per platform in layout.h
+#define INBOX_PHONE_INFO_SIZE        64
     
     
 //==================================================================================================
@@ -15,10 +26,34 @@
 // Variables
 
 static int s_update_age_counter_in_secs = 0;
-static int s_currently_updating = 0;
 static int s_first_update_performed = 0;
 static int s_first_update_after_n_secs = 2;
 
+// The inbox callback only copies the payload into these buffers and returns, parsing is done
+// in a separately scheduled callback. Bus data is copied straight into the back buffer of the
+// bus board, which swaps it to the front once it was parsed.
+static char s_inbox_bus_stop_data[ INBOX_BUS_STOP_DATA_SIZE ];
+static char s_inbox_phone_timings[ INBOX_PHONE_INFO_SIZE ];
+static char s_inbox_phone_stats[ INBOX_PHONE_INFO_SIZE ];
+
+// in the order the tuples are processed
+static struct {
+    uint32_t key;
+    char* buffer;   // NULL for the back buffer of the bus board
+    int size;
+    int length;
+    bool received;
+} s_inbox_slots[] = {
+    { BUS_STOP_DATA, s_inbox_bus_stop_data,  INBOX_BUS_STOP_DATA_SIZE, 0, false },
+    { BUS_DATA,      NULL,                   INBOX_BUS_DATA_SIZE,      0, false },
+    { PHONE_TIMINGS, s_inbox_phone_timings,  INBOX_PHONE_INFO_SIZE,    0, false },
+    { PHONE_STATS,   s_inbox_phone_stats,    INBOX_PHONE_INFO_SIZE,    0, false }
+};
+
+#define NUM_INBOX_SLOTS ( sizeof( s_inbox_slots ) / sizeof( s_inbox_slots[ 0 ] ) )
+
+static AppTimer* s_process_inbox_timer = NULL;
+
 //==================================================================================================
 //==================================================================================================
 // Helper functions
@@ -31,7 +66,7 @@ void refresh_update_status()
     int minutes = s_update_age_counter_in_secs / 60;
     int seconds = s_update_age_counter_in_secs % 60;
     
-    if( s_currently_updating == 1 )
+    if( request_scheduler_is_busy() )
     {
         snprintf( status_text, sizeof( "Updating..." ) , "Updating..." );
     }
@@ -73,44 +108,193 @@ void refresh_update_status()
 //==================================================================================================
 // App message handling
 
-void inbox_received_callback( DictionaryIterator* iterator, void* context )
+void handle_msg_data( uint32_t key, const char* data, int length )
 {
-    APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] Message received!" );
+    // the line filter reuses the fields the board found in the bus data, so the board goes first
+    bus_display_handle_msg( key, data, length );
+    bus_stop_selection_handle_msg( key, data, length );
+    line_filter_handle_msg( key, data, length );
+}
+
+int find_inbox_slot( uint32_t key )
+{
+    for( unsigned int i = 0; i != NUM_INBOX_SLOTS; ++i )
+    {
+        if( s_inbox_slots[ i ].key == key )
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+char* get_inbox_slot_buffer( int idx )
+{
+    return s_inbox_slots[ idx ].buffer != NULL ? s_inbox_slots[ idx ].buffer
+                                               : bus_display_get_bus_data_buffer();
+}
+
+bool inbox_slot_received( uint32_t key )
+{
+    const int idx = find_inbox_slot( key );
+    return idx != -1 && s_inbox_slots[ idx ].received;
+}
+
+void copy_to_inbox_slot( uint32_t key, const char* data, int length )
+{
+    const int idx = find_inbox_slot( key );
     
-    Tuple* t = dict_read_first( iterator );
-    s_currently_updating = 0;
-   
-    while( t != NULL )
+    if( idx == -1 )
     {
+        return;
+    }
+    
+    const int num_bytes = min( length, s_inbox_slots[ idx ].size - 1 );
+    
+    if( num_bytes < length )
+    {
+        APP_LOG( APP_LOG_LEVEL_WARNING, "[ACbus] Truncated tuple %d from %d to %d bytes.",
+                 ( int ) key, length, num_bytes );
+    }
+    
+    char* buffer = get_inbox_slot_buffer( idx );
+    memcpy( buffer, data, num_bytes );
+    buffer[ num_bytes ] = '\0';
+    // the string length, so parsers never have to look for the end themselves
+    s_inbox_slots[ idx ].length = num_bytes;
+    s_inbox_slots[ idx ].received = true;
+}
+
+void process_inbox_slot( int idx )
+{
+    handle_msg_data( s_inbox_slots[ idx ].key, get_inbox_slot_buffer( idx ), s_inbox_slots[ idx ].length );
+}
+
+void process_inbox_message( void* context )
+{
+    s_process_inbox_timer = NULL;
+    
+    const bool prewarm_done = prewarm_is_running() && inbox_slot_received( BUS_STOP_DATA ) &&
+                              inbox_slot_received( BUS_DATA );
+    
+    // stored before the payloads are processed, the bus board takes over its buffer
+    if( prewarm_done )
+    {
+        prewarm_store_result( get_inbox_slot_buffer( find_inbox_slot( BUS_STOP_DATA ) ),
+                              get_inbox_slot_buffer( find_inbox_slot( BUS_DATA ) ) );
+    }
+    
+    for( unsigned int i = 0; i != NUM_INBOX_SLOTS; ++i )
+    {
+        if( !s_inbox_slots[ i ].received )
+        {
+            continue;
+        }
+        
+        const char* data = get_inbox_slot_buffer( i );
+        
         // if bus stop data is in the message, it is a success
-        if( t->key == BUS_STOP_DATA )
+        if( s_inbox_slots[ i ].key == BUS_STOP_DATA )
         {
             s_update_age_counter_in_secs = 0;
             s_first_update_performed = 1;
         }
+        else if( s_inbox_slots[ i ].key == PHONE_TIMINGS )
+        {
+            latency_set_phone_timings( data );
+        }
+        else if( s_inbox_slots[ i ].key == PHONE_STATS )
+        {
+            stats_set_phone_stats( data );
+        }
         
-        bus_display_handle_msg_tuple( t );
-        bus_stop_selection_handle_msg_tuple( t );
+        process_inbox_slot( i );
+    }
+    
+    latency_commit();
+    
+    if( prewarm_done )
+    {
+        prewarm_finish();
+    }
+    
+    for( unsigned int i = 0; i != NUM_INBOX_SLOTS; ++i )
+    {
+        s_inbox_slots[ i ].received = false;
+    }
+}
+
+void copy_tuple_to_inbox_slot( Tuple* t )
+{
+    // length includes the trailing '\0' char
+    copy_to_inbox_slot( t->key, t->value->cstring, max( 0, ( int ) t->length - 1 ) );
+}
 
+/**
+ * Pre-warmed payloads take the same path as received ones, so the handlers can keep pointing into
+ * them after the replay buffer is gone.
+ */
+void replay_msg_data( uint32_t key, const char* data, int length )
+{
+    copy_to_inbox_slot( key, data, length );
+    process_inbox_slot( find_inbox_slot( key ) );
+    s_inbox_slots[ find_inbox_slot( key ) ].received = false;
+}
+
+void inbox_received_callback( DictionaryIterator* iterator, void* context )
+{
+    APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] Message received!" );
+    latency_mark( LATENCY_STAGE_INBOX_RECEIVED );
+    stats_increment( STAT_INBOX_MESSAGES, 1 );
+    stats_increment( STAT_INBOX_BYTES, dict_size( iterator ) );
+    
+    Tuple* generation = dict_find( iterator, GENERATION );
+    
+    if( !request_scheduler_accept_reply( generation != NULL ? generation->value->uint32 : 0 ) )
+    {
+        return;
+    }
+    
+    // a message that was not processed yet is simply replaced by the newer one
+    for( unsigned int i = 0; i != NUM_INBOX_SLOTS; ++i )
+    {
+        s_inbox_slots[ i ].received = false;
+    }
+    
+    Tuple* t = dict_read_first( iterator );
+   
+    while( t != NULL )
+    {
+        copy_tuple_to_inbox_slot( t );
         t = dict_read_next( iterator );
     }
+    
+    // release the inbox right away, so the next message is not dropped
+    if( s_process_inbox_timer == NULL )
+    {
+        s_process_inbox_timer = app_timer_register( 0, process_inbox_message, NULL );
+    }
 }
 
 void inbox_dropped_callback( AppMessageResult reason, void* context )
 {
     APP_LOG( APP_LOG_LEVEL_ERROR, "[ACbus] Message dropped!" );
+    stats_increment( STAT_INBOX_DROPPED, 1 );
 }
 
 void outbox_failed_callback( DictionaryIterator* iterator, AppMessageResult reason, void* context )
 {
     APP_LOG( APP_LOG_LEVEL_ERROR, "[ACbus] Outbox send failed! Reason: %s",
              common_app_message_result_to_string( reason ) );
-    s_currently_updating = 0;
+    stats_increment( STAT_OUTBOX_FAILED, 1 );
+    request_scheduler_handle_outbox_failed();
+    refresh_update_status();
 }
 
 void outbox_sent_callback( DictionaryIterator* iterator, void* context )
 {
     APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] Outbox send successful." );
+    request_scheduler_handle_outbox_sent();
 }
 
 
@@ -118,22 +302,10 @@ void outbox_sent_callback( DictionaryIterator* iterator, void* context )
 //==================================================================================================
 // Update request message
 
-void send_update_request()
+void request_update( RequestPriority priority )
 {
-    if( s_currently_updating == 0 )
-    {
-        s_currently_updating = 1;
-    
-        DictionaryIterator* iter = NULL;
-        app_message_outbox_begin( &iter );
-        
-        dict_write_uint32( iter, REQ_BUS_STOP_ID, common_get_current_bus_stop_id() );
-        dict_write_uint8( iter, REQ_UPDATE_BUS_STOP_LIST, 0 );
-        
-        app_message_outbox_send();
-        
-        refresh_update_status();
-    }    
+    request_scheduler_request( priority );
+    refresh_update_status();
 }
 
 
@@ -144,19 +316,29 @@ void send_update_request()
 void tick_handler( struct tm* tick_time, TimeUnits unites_changed )
 {
     ++s_update_age_counter_in_secs;
+    request_scheduler_tick();
     refresh_update_status();
     
+    stats_increment( STAT_TICKS, 1 );
+    stats_display_refresh();
+    
+    // save regularly, so the counters survive crashes and battery pulls
+    if( stats_get_session( STAT_TICKS ) % STATS_SAVE_INTERVAL_IN_SECS == 0 )
+    {
+        stats_save();
+    }
+    
     if( s_update_age_counter_in_secs % UPDATE_FREQUENCY_IN_SECS == 0 ||
         ( s_first_update_performed == 0 && s_update_age_counter_in_secs == s_first_update_after_n_secs ) )
     {   
         APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] Requesting bus update." ); 
-        common_get_update_callback()();
+        common_get_update_callback()( REQUEST_PRIORITY_PERIODIC );
     }
 }
 
 void tap_handler( AccelAxisType axis, int32_t direction )
 {
-    common_get_update_callback()();
+    common_get_update_callback()( REQUEST_PRIORITY_TAP );
 }
 
 
@@ -166,12 +348,15 @@ void tap_handler( AccelAxisType axis, int32_t direction )
 
 void init()
 {
-    // set up global common state
-    common_set_update_callback( send_update_request );
+    const uint32_t start_ms = common_time_ms();
+    const int heap_used_at_launch = heap_bytes_used();
     
-    // init windows
-    bus_stop_selection_create();
+    // set up global common state
+    common_set_update_callback( request_update );
+    stats_load();
+    line_filter_load();
     
+    // init main window, all other windows are created when they are shown
     bus_display_create();
     bus_display_show();
     
@@ -180,19 +365,50 @@ void init()
     app_message_register_inbox_dropped( inbox_dropped_callback );
     app_message_register_outbox_failed( outbox_failed_callback );
     app_message_register_outbox_sent( outbox_sent_callback );
-    app_message_open( app_message_inbox_size_maximum(), app_message_outbox_size_maximum() );
+    const size_t heap_mark = common_heap_mark();
+    app_message_open( APP_MESSAGE_INBOX_SIZE, APP_MESSAGE_OUTBOX_SIZE );
+    common_heap_account( HEAP_TAG_MESSAGING, heap_mark );
     
     // set up periodic updates
     tick_timer_service_subscribe( SECOND_UNIT, tick_handler );
     
     // set up tap recognition
     accel_tap_service_subscribe( tap_handler );
+    
+    // set up commute pre-warming
+    prewarm_init();
+    
+    if( launch_reason() == APP_LAUNCH_WAKEUP )
+    {
+        // a pre-warm run performs the regular first update and quits once it is done
+        if( !prewarm_begin() )
+        {
+            window_stack_pop_all( false );
+        }
+    }
+    else
+    {
+        int age_in_secs = 0;
+        
+        if( prewarm_replay_result( replay_msg_data, &age_in_secs ) )
+        {
+            APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] Showing pre-warmed data, %d secs old.", age_in_secs );
+            s_update_age_counter_in_secs = age_in_secs;
+            s_first_update_performed = 1;
+            refresh_update_status();
+        }
+    }
+    
+    APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] Startup took %d ms. Heap used: %d bytes at launch, %d bytes after init, %d bytes free.",
+             ( int ) ( common_time_ms() - start_ms ), heap_used_at_launch, ( int ) heap_bytes_used(),
+             ( int ) heap_bytes_free() );
 }
 
 void deinit()
 {
+    stats_save();
+    
     bus_display_destroy();
-    bus_stop_selection_destroy();
 }
 
 
@@ -6,6 +6,25 @@ var query_url_base = 'http://ivu.aseag.de/interfaces/ura/instant_V1?ReturnList='
 var query_url_bus = query_url_base + 'StopPointName,LineName,DestinationName,EstimatedTime&StopID=';
 var query_url_stops = query_url_base + 'StopPointName,StopID,Longitude,Latitude';
 
+// radio and payload accounting; session and all-time counters are reported to the watch, the
+// all-time counters are kept in local storage
+var stats_storage_key = 'acbus_stats';
+var session_stats = { http_requests: 0, http_bytes: 0, geolocations: 0 };
+var total_stats = JSON.parse( localStorage.getItem( stats_storage_key ) ) ||
+                  { http_requests: 0, http_bytes: 0, geolocations: 0 };
+
+// parsed predictions per bus stop id, sorted by eta, and the callbacks waiting for predictions
+// that are currently being fetched
+var prediction_cache_ttl_ms = 15000;
+var prediction_cache = {};
+var pending_predictions = {};
+
+// http requests that did not complete by then count as failed
+var http_timeout_ms = 10000;
+
+// generation id of the most recent request of the watch; work for older ones is abandoned
+var latest_generation = 0;
+
 
 //==================================================================================================
 //==================================================================================================
@@ -30,14 +49,56 @@ function cleanUpBusStopName( bus_stop_name ) {
 }
 
 
-var xhrRequest = function( url, type, callback ) {
+function countStat( name, amount ) {
+    session_stats[ name ] += amount;
+    total_stats[ name ] += amount;
+}
+
+function saveStats() {
+    localStorage.setItem( stats_storage_key, JSON.stringify( total_stats ) );
+}
+
+function compilePhoneStats() {
+    // http requests;http bytes;geolocation calls of this session, then the same all-time
+    return session_stats.http_requests + ';' +
+           session_stats.http_bytes + ';' +
+           session_stats.geolocations + ';' +
+           total_stats.http_requests + ';' +
+           total_stats.http_bytes + ';' +
+           total_stats.geolocations;
+}
+
+
+var xhrRequest = function( url, type, callback, error_callback ) {
     console.log( '[ACbus] Sending http request to URL <' + url + '>.' );
+    countStat( 'http_requests', 1 );
     
     var xhr = new XMLHttpRequest();
+    var failed = function( reason ) {
+        console.log( '[ACbus] Http request to URL <' + url + '> failed: ' + reason + '.' );
+        if( error_callback ) {
+            error_callback();
+        }
+    };
+    
     xhr.onload = function() {
+        countStat( 'http_bytes', this.responseText.length );
+        
+        // error pages must neither be parsed nor cached as predictions
+        if( this.status !== 200 ) {
+            failed( 'status ' + this.status );
+            return;
+        }
         callback( this.responseText );
     };
+    xhr.onerror = function() {
+        failed( 'error' );
+    };
+    xhr.ontimeout = function() {
+        failed( 'timeout' );
+    };
     xhr.open( type, url );
+    xhr.timeout = http_timeout_ms;
     xhr.send( null );
 };
 
@@ -161,12 +222,26 @@ function parseBuses( response_text ) {
     return buses;
 }
 
-function compileListOfNextBuses( buses, num_next_buses ) {
+function sortBusesByEta( buses ) {
     // order list with respect to estimated time of arrival
     buses.sort( function( lhs, rhs ) {
         return lhs.eta - rhs.eta;
     } );
     
+    return buses;
+}
+
+/**
+ * Expects buses to be sorted by eta, see sortBusesByEta. If wanted_lines is not empty, only
+ * buses of these lines are listed. This is a fallback for when the query was not filtered.
+ */
+function compileListOfNextBuses( buses, num_next_buses, wanted_lines ) {
+    if( wanted_lines.length > 0 ) {
+        buses = buses.filter( function( bus ) {
+            return wanted_lines.indexOf( bus.number ) != -1;
+        } );
+    }
+    
     var num_buses = Math.min( num_next_buses, buses.length );
     var bus_data = "";
 
@@ -186,26 +261,149 @@ function compileListOfNextBuses( buses, num_next_buses ) {
 }
 
 
+//==================================================================================================
+//==================================================================================================
+// Prediction cache
+
+function agedPredictions( cache_entry ) {
+    // etas are relative to the time of the fetch, so they shrink while the entry ages
+    var age = Date.now() - cache_entry.fetched_at;
+    
+    return cache_entry.buses.map( function( bus ) {
+        return { number: bus.number, dest: bus.dest, eta: bus.eta - age };
+    } );
+}
+
+function parseLineFilter( line_filter ) {
+    // "bus stop id;line;line;..." as sent by the watch, if the rider filters lines at a stop
+    if( !line_filter ) {
+        return { bus_stop_id: -1, lines: [] };
+    }
+    
+    var items = line_filter.split( ';' );
+    return { bus_stop_id: items[ 0 ], lines: items.slice( 1 ) };
+}
+
+/**
+ * Calls callback with the sorted predictions for the given bus stop, restricted to the given
+ * lines unless that list is empty, or with null if they could not be fetched. Fresh predictions
+ * are served from memory, and all requests that are already being fetched share that fetch.
+ */
+function getPredictions( bus_stop_id, wanted_lines, callback ) {
+    var cache_key = bus_stop_id + '|' + wanted_lines.join( ',' );
+    var cache_entry = prediction_cache[ cache_key ];
+    
+    if( cache_entry && Date.now() - cache_entry.fetched_at < prediction_cache_ttl_ms ) {
+        console.log( '[ACbus] Serving predictions for ' + cache_key + ' from cache.' );
+        callback( agedPredictions( cache_entry ) );
+        return;
+    }
+    
+    if( pending_predictions[ cache_key ] ) {
+        console.log( '[ACbus] Joining pending prediction request for ' + cache_key + '.' );
+        pending_predictions[ cache_key ].push( callback );
+        return;
+    }
+    
+    pending_predictions[ cache_key ] = [ callback ];
+    
+    // let the server drop the lines nobody wants to see
+    var url = query_url_bus + bus_stop_id;
+    if( wanted_lines.length > 0 ) {
+        url += '&LineName=' + wanted_lines.map( encodeURIComponent ).join( ',' );
+    }
+    
+    xhrRequest( url, 'GET',
+        function( response_text ) {
+            var callbacks = pending_predictions[ cache_key ];
+            delete pending_predictions[ cache_key ];
+            
+            // a malformed response throws in parseBuses, which is answered like a failed fetch
+            var buses = null;
+            try {
+                buses = sortBusesByEta( parseBuses( response_text ) );
+            } catch( e ) {
+                console.log( '[ACbus] Could not parse predictions for ' + cache_key + ': ' + e + '.' );
+            }
+            
+            if( buses !== null ) {
+                cache_entry = { fetched_at: Date.now(), buses: buses };
+                prediction_cache[ cache_key ] = cache_entry;
+            }
+            
+            for( var i = 0; i < callbacks.length; ++i ) {
+                callbacks[ i ]( buses !== null ? agedPredictions( cache_entry ) : null );
+            }
+        },
+        function() {
+            var callbacks = pending_predictions[ cache_key ];
+            delete pending_predictions[ cache_key ];
+            
+            // every waiting request is still answered, so the watch does not wait for its timeout
+            for( var i = 0; i < callbacks.length; ++i ) {
+                callbacks[ i ]( null );
+            }
+        } );
+}
+
+
 //==================================================================================================
 //==================================================================================================
 // Data update functions
 
-function sendUpdate( bus_stop_data, bus_data ) {
+function isSuperseded( generation ) {
+    if( generation < latest_generation ) {
+        console.log( '[ACbus] Abandoning superseded request ' + generation + '.' );
+        return true;
+    }
+    return false;
+}
+
+function compilePhoneTimings( timings ) {
+    // gps;stop list http;predictions http;total -- all in ms
+    return ( timings.gps - timings.start ) + ';' +
+           ( timings.stops - timings.gps ) + ';' +
+           ( timings.buses - timings.stops ) + ';' +
+           ( Date.now() - timings.start );
+}
+
+function sendUpdate( bus_stop_data, bus_data, timings, generation ) {
      var dict = {
+        'GENERATION': generation,
         'BUS_STOP_DATA': bus_stop_data,
-        'BUS_DATA': bus_data
+        'BUS_DATA': bus_data,
+        'PHONE_TIMINGS': compilePhoneTimings( timings ),
+        'PHONE_STATS': compilePhoneStats()
     };
     
+    saveStats();
+    
     console.log( '[ACbus] Sending update.' );
     Pebble.sendAppMessage( dict );
     console.log( '[ACbus] Sent update.' );
 }
 
-function findClosestBusStopForCoords( coords, requested_bus_stop_id ) {       
+/**
+ * Answers a request that could not be served with its generation only. The watch stops waiting
+ * for it and keeps showing the buses it has.
+ */
+function sendFailure( generation ) {
+    saveStats();
+    
+    console.log( '[ACbus] Sending failure of request ' + generation + '.' );
+    Pebble.sendAppMessage( { 'GENERATION': generation } );
+}
+
+function findClosestBusStopForCoords( coords, requested_bus_stop_id, line_filter, max_buses, max_bus_stops, timings, generation ) {       
     xhrRequest( query_url_stops, 'GET', function( response_text ) {
+        timings.stops = Date.now();
+        if( isSuperseded( generation ) ) {
+            return;
+        }
+        
         var bus_stops = parseBusStops( response_text );
         bus_stops = updateBusStopDistances( coords, bus_stops );
-        var bus_stop_data = compileListOfClosestBusStops( bus_stops, 6 );
+        var bus_stop_data = compileListOfClosestBusStops( bus_stops, max_bus_stops );
    
         // closest bus stop is default
         var selected_bus_stop_id = bus_stops[ 0 ].id;
@@ -233,14 +431,31 @@ function findClosestBusStopForCoords( coords, requested_bus_stop_id ) {
                             bus_stop_data; 
         }
    
-        xhrRequest( query_url_bus + selected_bus_stop_id, 'GET', function( response_text ) {
+        // the filter belongs to a specific bus stop, which might not be the closest one any more
+        var wanted_lines = line_filter.bus_stop_id == selected_bus_stop_id ? line_filter.lines : [];
+        
+        getPredictions( selected_bus_stop_id, wanted_lines, function( buses ) {
+            timings.buses = Date.now();
+            if( isSuperseded( generation ) ) {
+                return;
+            }
+            
+            if( buses === null ) {
+                sendFailure( generation );
+                return;
+            }
+            
             console.log( '[ACbus] Getting next buses for ' + selected_bus_stop_name + '.' );
 
-            var buses = parseBuses( response_text );
-            var bus_data = compileListOfNextBuses( buses, 21 );            
+            var bus_data = compileListOfNextBuses( buses, max_buses, wanted_lines );
             
-            sendUpdate( bus_stop_data, bus_data );
+            sendUpdate( bus_stop_data, bus_data, timings, generation );
         } );
+    },
+    function() {
+        if( !isSuperseded( generation ) ) {
+            sendFailure( generation );
+        }
     } );
 }
 
@@ -249,25 +464,34 @@ function findClosestBusStopForCoords( coords, requested_bus_stop_id ) {
 //==================================================================================================
 // GPS coord query
 
-function determineClosestBusStop( requested_bus_stop_id ) {
+function determineClosestBusStop( requested_bus_stop_id, line_filter, max_buses, max_bus_stops, timings, generation ) {
     console.log( '[ACbus] ######## Initiated new bus stop update.' );
     console.log( '[ACbus] Querying current GPS coordinates.' );
+    countStat( 'geolocations', 1 );
     
     navigator.geolocation.getCurrentPosition(
         // success
         function( pos ) {
+            timings.gps = Date.now();
             console.log( '[ACbus] GPS request succeeded.' );
+            if( isSuperseded( generation ) ) {
+                return;
+            }
+            
             var gps_coords = pos.coords;
             // Debug info for Aachen Bushof
             //var gps_coords = { longitude: 6.0908191, latitude: 50.7775936 };
             
             console.log( '[ACbus] Received new gps coords at ' +
                          '(lon: ' + gps_coords.longitude + ', lat: ' + gps_coords.latitude + ').'  );
-            findClosestBusStopForCoords( gps_coords, requested_bus_stop_id );
+            findClosestBusStopForCoords( gps_coords, requested_bus_stop_id, line_filter, max_buses, max_bus_stops, timings, generation );
         },
         // failure
         function( err ) {
             console.log( '[ACbus] An error occured while getting new location data. Error: ' + err );
+            if( !isSuperseded( generation ) ) {
+                sendFailure( generation );
+            }
         },
         // geoloc request params    
         { timeout: 10000, maximumAge: 10000 }
@@ -286,6 +510,7 @@ Pebble.addEventListener( 'ready',
 Pebble.addEventListener( 'appmessage',
     function( e ) {
         console.log( '[ACbus] AppMessage received!' ) ;
+        var timings = { start: Date.now() };
 
         var stringified = JSON.stringify( e.payload );
         var request = JSON.parse( stringified );
@@ -293,9 +518,24 @@ Pebble.addEventListener( 'appmessage',
                 
         var requested_bus_stop_id = request.REQ_BUS_STOP_ID;
         var update_bus_stop_list = request.REQ_UPDATE_BUS_STOP_LIST;
+        var generation = request.REQ_GENERATION || 0;
+        var line_filter = parseLineFilter( request.REQ_LINE_FILTER );
+        // the watch asks for as many buses as its platform can show, older versions always took 21
+        var max_buses = request.REQ_MAX_BUSES || 21;
+        var max_bus_stops = request.REQ_MAX_BUS_STOPS || 6;
+        // the watch starts over at generation 1 in every app session, while this context may
+        // outlive a session, e.g. a pre-warm run followed by a quick relaunch
+        if( generation == 1 ) {
+            latest_generation = 0;
+        }
+        latest_generation = Math.max( latest_generation, generation );
         
         console.log( '[ACbus] Request received with REQ_BUS_STOP_ID <' + requested_bus_stop_id +
-                     '> and REQ_UPDATE_BUS_STOP_LIST <' + update_bus_stop_list + '>.' );
+                     '> and REQ_UPDATE_BUS_STOP_LIST <' + update_bus_stop_list +
+                     '> and REQ_GENERATION <' + generation +
+                     '> and REQ_LINE_FILTER <' + request.REQ_LINE_FILTER +
+                     '> and REQ_MAX_BUSES <' + max_buses +
+                     '> and REQ_MAX_BUS_STOPS <' + max_bus_stops + '>.' );
         
-        determineClosestBusStop( requested_bus_stop_id );
+        determineClosestBusStop( requested_bus_stop_id, line_filter, max_buses, max_bus_stops, timings, generation );
     } );
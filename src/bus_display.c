@@ -1,25 +1,19 @@
 #include "bus_display.h"
 #include "bus_stop_selection.h"
+#include "latency.h"
+#include "stats.h"
+#include "stats_display.h"
+#include "line_filter.h"
 
 //==================================================================================================
 //==================================================================================================
 // Definitions
 
-// Layout information
-#define NUM_BUSES               21
-#define NUM_BUSES_PER_PAGE       7
-    
-#define BUS_ENTRY_MARGIN_TOP    28
-#define BUS_ENTRY_MARGIN_LEFT    3
-#define BUS_ENTRY_HEIGHT        16
-#define BUS_ENTRY_LINE_WIDTH    28
-#define BUS_ENTRY_DEST_WIDTH    92
-#define BUS_ENTRY_ETA_WIDTH     18
-
-// Bus data buffer sizes
-#define LINE_BUFFER_SIZE         6
+// Layout information, NUM_BUSES and the BUS_ENTRY_* widths are defined per platform in layout.h
+#define NUM_BUSES_PER_PAGE      NUM_ROWS
+
+// Bus stop name buffer size
 #define DEST_BUFFER_SIZE        32
-#define ETA_BUFFER_SIZE          6
 
 
 //==================================================================================================
@@ -30,23 +24,37 @@ static Window* s_bus_display_wnd = NULL;
 static TextLayer* s_bus_display_title = NULL;
 static TextLayer* s_bus_display_status = NULL;
 static BitmapLayer* s_bus_display_banner = NULL;
+static TextLayer* s_bus_display_debug = NULL;
+static int s_debug_page = 0;
 static GColor s_line_colors[ 10 ];
 static int s_current_page = 0;
     
 static char s_bus_stop_name[ DEST_BUFFER_SIZE ];
-static int s_num_buses_transmitted = 0;
     
+// The text layers point straight into the fields of the front buffer, which is not written
+// while it is the front, so they never show a partially parsed board.
 struct {
     TextLayer* line;
     TextLayer* dest;
     TextLayer* eta;
 } s_bus_display_lines[ NUM_BUSES_PER_PAGE ];
+
+// The board keeps the spans of the fields of the last BUS_DATA payload: the number of buses,
+// followed by line;destination;eta of every bus. New payloads are received into the back buffer,
+// which becomes the front buffer as a whole once it was parsed.
+#define BUS_DATA_FIELDS_PER_BUS  3
+#define NUM_BUS_DATA_SPANS      ( 1 + BUS_DATA_FIELDS_PER_BUS * NUM_BUSES )
+
+static struct {
+    int num_buses_transmitted;
     
-struct {    
-    char line_string[ LINE_BUFFER_SIZE ];
-    char dest_string[ DEST_BUFFER_SIZE ];
-    char eta_string[ ETA_BUFFER_SIZE ];
-} s_buses[ NUM_BUSES ];
+    CsvSpan spans[ NUM_BUS_DATA_SPANS ];
+    CsvTokens tokens;
+} s_bus_board;
+
+static char s_bus_data_buffers[ 2 ][ INBOX_BUS_DATA_SIZE ];
+static char* s_bus_data_front = s_bus_data_buffers[ 0 ];
+static char* s_bus_data_back = s_bus_data_buffers[ 1 ];
 
 
 //==================================================================================================
@@ -55,35 +63,35 @@ struct {
 
 GRect line_rect( int index )
 {
-    return GRect( 0,
-                  BUS_ENTRY_MARGIN_TOP + index * BUS_ENTRY_HEIGHT,
+    return GRect( BUS_ENTRY_LEFT,
+                  ROW_TOP + index * ROW_HEIGHT,
                   BUS_ENTRY_LINE_WIDTH,
-                  BUS_ENTRY_HEIGHT );
+                  ROW_HEIGHT );
 }
 
 GRect dest_rect( int index )
 {
-    return GRect( BUS_ENTRY_MARGIN_LEFT + BUS_ENTRY_LINE_WIDTH,
-                  BUS_ENTRY_MARGIN_TOP + index * BUS_ENTRY_HEIGHT,
+    return GRect( BUS_ENTRY_LEFT + BUS_ENTRY_MARGIN_LEFT + BUS_ENTRY_LINE_WIDTH,
+                  ROW_TOP + index * ROW_HEIGHT,
                   BUS_ENTRY_DEST_WIDTH,
-                  BUS_ENTRY_HEIGHT );
+                  ROW_HEIGHT );
 }
 
 GRect eta_rect( int index )
 {
-    return GRect( BUS_ENTRY_MARGIN_LEFT + BUS_ENTRY_LINE_WIDTH + BUS_ENTRY_DEST_WIDTH,
-                  BUS_ENTRY_MARGIN_TOP + index * BUS_ENTRY_HEIGHT,
+    return GRect( BUS_ENTRY_LEFT + BUS_ENTRY_MARGIN_LEFT + BUS_ENTRY_LINE_WIDTH + BUS_ENTRY_DEST_WIDTH,
+                  ROW_TOP + index * ROW_HEIGHT,
                   BUS_ENTRY_ETA_WIDTH,
-                  BUS_ENTRY_HEIGHT );
+                  ROW_HEIGHT );
 }
 
 void create_bus_text_layers()
 {    
     for( int i = 0; i < NUM_BUSES_PER_PAGE; ++i )
     {
-        common_create_text_layer( &s_bus_display_lines[ i ].line, s_bus_display_wnd, line_rect( i ), GColorWhite, GColorBlack, FONT_KEY_GOTHIC_14_BOLD, GTextAlignmentCenter );
-        common_create_text_layer( &s_bus_display_lines[ i ].dest, s_bus_display_wnd, dest_rect( i ), GColorWhite, GColorBlack, FONT_KEY_GOTHIC_14, GTextAlignmentLeft );
-        common_create_text_layer( &s_bus_display_lines[ i ].eta, s_bus_display_wnd, eta_rect( i ), GColorWhite, GColorBlack, FONT_KEY_GOTHIC_14_BOLD, GTextAlignmentRight );
+        common_create_text_layer( HEAP_TAG_DISPLAY, &s_bus_display_lines[ i ].line, s_bus_display_wnd, line_rect( i ), GColorWhite, GColorBlack, FONT_KEY_GOTHIC_14_BOLD, GTextAlignmentCenter );
+        common_create_text_layer( HEAP_TAG_DISPLAY, &s_bus_display_lines[ i ].dest, s_bus_display_wnd, dest_rect( i ), GColorWhite, GColorBlack, FONT_KEY_GOTHIC_14, GTextAlignmentLeft );
+        common_create_text_layer( HEAP_TAG_DISPLAY, &s_bus_display_lines[ i ].eta, s_bus_display_wnd, eta_rect( i ), GColorWhite, GColorBlack, FONT_KEY_GOTHIC_14_BOLD, GTextAlignmentRight );
     }
 }
 
@@ -91,9 +99,9 @@ void destroy_bus_text_layers()
 {
     for( int i = 0; i < NUM_BUSES_PER_PAGE; ++i )
     {
-        text_layer_destroy( s_bus_display_lines[ i ].line );
-        text_layer_destroy( s_bus_display_lines[ i ].dest );
-        text_layer_destroy( s_bus_display_lines[ i ].eta );
+        common_destroy_text_layer( HEAP_TAG_DISPLAY, s_bus_display_lines[ i ].line );
+        common_destroy_text_layer( HEAP_TAG_DISPLAY, s_bus_display_lines[ i ].dest );
+        common_destroy_text_layer( HEAP_TAG_DISPLAY, s_bus_display_lines[ i ].eta );
     }
 }
 
@@ -108,6 +116,13 @@ void set_bus_text_layer( int index, const char* line, GColor line_color, const c
 
 void fill_line_colors()
 {
+#if defined( PBL_BW )
+    // line colors cannot be told apart on black and white displays
+    for( int i = 0; i != 10; ++i )
+    {
+        s_line_colors[ i ] = GColorWhite;
+    }
+#else
     s_line_colors[ 0 ] = GColorIslamicGreen;
     s_line_colors[ 1 ] = GColorMintGreen;
     s_line_colors[ 2 ] = GColorMidnightGreen;
@@ -118,6 +133,7 @@ void fill_line_colors()
     s_line_colors[ 7 ] = GColorBrilliantRose;
     s_line_colors[ 8 ] = GColorCadetBlue;
     s_line_colors[ 9 ] = GColorYellow;
+#endif
 }
 
 
@@ -153,15 +169,24 @@ GColor get_line_color( const char* line )
 
 void update_bus_text_layers()
 {
+    stats_increment( STAT_REDRAWS, 1 );
+    
+    // a local copy, so the tokens are not read again for every field
+    const CsvTokens tokens = s_bus_board.tokens;
+    
     for( int i = 0; i < NUM_BUSES_PER_PAGE; ++i )
     {
         int base_index = NUM_BUSES_PER_PAGE * s_current_page;
         int bus_index = base_index + i;
         
-        set_bus_text_layer( i, s_buses[ bus_index ].line_string,
-                               get_line_color( s_buses[ bus_index ].line_string ),
-                               s_buses[ bus_index ].dest_string,
-                               s_buses[ bus_index ].eta_string );
+        // missing fields of a short list are empty strings
+        const int first_span = 1 + bus_index * BUS_DATA_FIELDS_PER_BUS;
+        const char* line = common_csv_get_string( &tokens, first_span );
+        
+        set_bus_text_layer( i, line,
+                               get_line_color( line ),
+                               common_csv_get_string( &tokens, first_span + 1 ),
+                               common_csv_get_string( &tokens, first_span + 2 ) );
     }
 }
 
@@ -195,61 +220,51 @@ void update_time_stamp()
 //==================================================================================================
 // Message parsing
 
-void parse_first_bus_stop( const char* bus_stop_data )
+void parse_first_bus_stop( const char* bus_stop_data, int length )
 {
-    if( bus_stop_data != NULL && bus_stop_data != '\0' )
+    if( bus_stop_data != NULL && length > 0 )
     {
+        // only the name of the first entry is needed
+        CsvSpan name_span;
+        CsvTokens tokens;
+        common_csv_tokenize( &tokens, bus_stop_data, length, &name_span, 1 );
+        
         // add no indicator if bus stop is detected automatically
         if( common_get_current_bus_stop_id() == -1 )
         {
-            common_read_csv_item( bus_stop_data, s_bus_stop_name, DEST_BUFFER_SIZE );            
+            common_csv_copy( &tokens, 0, s_bus_stop_name, DEST_BUFFER_SIZE );
         }
         else
         {
-            char bus_stop_name[ DEST_BUFFER_SIZE ];
-            common_read_csv_item( bus_stop_data, bus_stop_name, DEST_BUFFER_SIZE );
-            // 2 + strlen --> * char + \0 char + bus stop name
-            snprintf( s_bus_stop_name, 2 + strlen( bus_stop_name ), "*%s", bus_stop_name );
+            s_bus_stop_name[ 0 ] = '*';
+            common_csv_copy( &tokens, 0, s_bus_stop_name + 1, DEST_BUFFER_SIZE - 1 );
         }
         
         text_layer_set_text( s_bus_display_title, s_bus_stop_name );
     }
 }
 
+void swap_bus_data_buffers()
+{
+    char* tmp = s_bus_data_front;
+    s_bus_data_front = s_bus_data_back;
+    s_bus_data_back = tmp;
+}
+
 /**
- * This function takes the string as provided by a BUS_DATA app message, parses it,
- * and uses the parsed data to update all bus text layers.
+ * This function takes the string as provided by a BUS_DATA app message in the back buffer,
+ * terminates all fields in place, keeps their spans on the board, swaps the buffer to the front
+ * and renders the current page from it.
  */
-void parse_bus_data( const char* bus_data )
+void parse_bus_data( int length )
 {   
-    if( *bus_data != '\0' )
-    {
-        char num_buses_string[ 8 ];
-        bus_data = common_read_csv_item( bus_data, num_buses_string, 8 );
-        s_num_buses_transmitted = atoi( num_buses_string );
-    }
-    
-    for( int i = 0; i < NUM_BUSES; ++i )
-    {
-        if( *bus_data != '\0' ) // eof reached?
-        {
-            // read line
-            bus_data = common_read_csv_item( bus_data, s_buses[ i ].line_string, LINE_BUFFER_SIZE );
-            // read destination
-            bus_data = common_read_csv_item( bus_data, s_buses[ i ].dest_string, DEST_BUFFER_SIZE );
-            // read eta
-            bus_data = common_read_csv_item( bus_data, s_buses[ i ].eta_string, ETA_BUFFER_SIZE );
-        }
-        else
-        {
-            // if no data is available, we still need to reset the strings
-            s_buses[ i ].line_string[ 0 ] = '\0';
-            s_buses[ i ].dest_string[ 0 ] = '\0';
-            s_buses[ i ].eta_string[ 0 ] = '\0';
-        }
-    }
+    common_csv_tokenize_in_place( &s_bus_board.tokens, s_bus_data_back, length, s_bus_board.spans, NUM_BUS_DATA_SPANS );
+    s_bus_board.num_buses_transmitted = common_csv_get_int( &s_bus_board.tokens, 0, 0 );
     
+    latency_mark( LATENCY_STAGE_PARSE_DONE );
+    swap_bus_data_buffers();
     update_bus_text_layers();
+    latency_mark( LATENCY_STAGE_LAYERS_UPDATED );
 }
 
 
@@ -268,7 +283,7 @@ void bus_display_previous_page( ClickRecognizerRef recognizer, void* context )
 
 void bus_display_next_page( ClickRecognizerRef recognizer, void* context )
 {
-    int curr_num_buses = min( NUM_BUSES, s_num_buses_transmitted );
+    int curr_num_buses = min( NUM_BUSES, s_bus_board.num_buses_transmitted );
     int max_pages = ( curr_num_buses / NUM_BUSES_PER_PAGE ) +
                     ( curr_num_buses % NUM_BUSES_PER_PAGE != 0 ? 1 : 0 );
     
@@ -279,17 +294,65 @@ void bus_display_next_page( ClickRecognizerRef recognizer, void* context )
     }
 }
 
+/**
+ * Cycles the hidden debug overlay through: off -> latency percentiles -> heap usage -> off
+ */
+void bus_display_toggle_debug_overlay( ClickRecognizerRef recognizer, void* context )
+{
+    // static ensures longevity of buffer
+    static char debug_text[ 160 ];
+    
+    s_debug_page = ( s_debug_page + 1 ) % 3;
+    
+    switch( s_debug_page )
+    {
+        case 1:
+        {
+            latency_format_summary( debug_text, sizeof( debug_text ) );
+            latency_dump_to_log();
+        }
+        break;
+        case 2:
+        {
+            common_heap_format_report( debug_text, sizeof( debug_text ) );
+            common_heap_log_report();
+        }
+        break;
+        default:
+        // intentionally left blank
+        break;
+    }
+    
+    text_layer_set_text( s_bus_display_debug, debug_text );
+    layer_set_hidden( text_layer_get_layer( s_bus_display_debug ), s_debug_page == 0 );
+}
+
 void open_bus_stop_select_window_handler( ClickRecognizerRef recognizer, void* context )
 {
     bus_stop_selection_show();
 }
 
+void open_line_filter_window_handler( ClickRecognizerRef recognizer, void* context )
+{
+    line_filter_show();
+}
+
+void open_stats_window_handler( ClickRecognizerRef recognizer, void* context )
+{
+    stats_display_show();
+}
+
 void click_provider( Window* window )
 {
     window_single_click_subscribe( BUTTON_ID_SELECT, open_bus_stop_select_window_handler );
+    window_long_click_subscribe( BUTTON_ID_SELECT, 0, open_line_filter_window_handler, NULL );
     
     window_single_click_subscribe( BUTTON_ID_UP, bus_display_previous_page );
     window_single_click_subscribe( BUTTON_ID_DOWN, bus_display_next_page );    
+    
+    // hidden debug overlay with latency percentiles and heap usage
+    window_long_click_subscribe( BUTTON_ID_UP, 0, bus_display_toggle_debug_overlay, NULL );
+    window_long_click_subscribe( BUTTON_ID_DOWN, 0, open_stats_window_handler, NULL );
 }
 
 
@@ -299,23 +362,29 @@ void click_provider( Window* window )
 
 void bus_display_window_load()
 {
-    common_create_text_layer( &s_bus_display_title, s_bus_display_wnd, GRect( 24, 0, 120, 20 ), GColorDarkCandyAppleRed, GColorWhite, FONT_KEY_GOTHIC_18_BOLD, GTextAlignmentLeft );
+    common_create_text_layer( HEAP_TAG_DISPLAY, &s_bus_display_title, s_bus_display_wnd, TITLE_RECT, COLOR_ACCENT, GColorWhite, FONT_KEY_GOTHIC_18_BOLD, GTextAlignmentLeft );
     text_layer_set_text( s_bus_display_title, "Initializing ..." );
  
-    common_create_text_layer( &s_bus_display_status, s_bus_display_wnd, GRect( 0, 148, 144, 20 ), GColorDarkCandyAppleRed, GColorWhite, FONT_KEY_GOTHIC_14, GTextAlignmentCenter );
+    common_create_text_layer( HEAP_TAG_DISPLAY, &s_bus_display_status, s_bus_display_wnd, STATUS_RECT, COLOR_ACCENT, GColorWhite, FONT_KEY_GOTHIC_14, GTextAlignmentCenter );
     text_layer_set_text( s_bus_display_status, "No updates, yet." );
     
-    common_create_h_icon( &s_bus_display_banner, s_bus_display_wnd );
+    common_create_h_icon( HEAP_TAG_DISPLAY, &s_bus_display_banner, s_bus_display_wnd );
     
     create_bus_text_layers(); 
+    
+    // created last to be drawn on top of the bus entries
+    common_create_text_layer( HEAP_TAG_DISPLAY, &s_bus_display_debug, s_bus_display_wnd, CONTENT_RECT, GColorWhite, GColorBlack, FONT_KEY_GOTHIC_14, GTextAlignmentLeft );
+    layer_set_hidden( text_layer_get_layer( s_bus_display_debug ), true );
+    s_debug_page = 0;
 }
 
 void bus_display_window_unload()
 {
+    common_destroy_text_layer( HEAP_TAG_DISPLAY, s_bus_display_debug );
     destroy_bus_text_layers();
-    bitmap_layer_destroy( s_bus_display_banner );
-    text_layer_destroy( s_bus_display_status );
-    text_layer_destroy( s_bus_display_title );    
+    common_destroy_h_icon( HEAP_TAG_DISPLAY, s_bus_display_banner );
+    common_destroy_text_layer( HEAP_TAG_DISPLAY, s_bus_display_status );
+    common_destroy_text_layer( HEAP_TAG_DISPLAY, s_bus_display_title );    
 }
 
 
@@ -325,7 +394,7 @@ void bus_display_window_unload()
 
 void bus_display_create()
 {
-    s_bus_display_wnd = window_create();
+    s_bus_display_wnd = common_window_create( HEAP_TAG_DISPLAY );
     
 	window_set_window_handlers( s_bus_display_wnd, ( WindowHandlers )
         {
@@ -340,7 +409,7 @@ void bus_display_create()
 
 void bus_display_destroy()
 {
-	window_destroy( s_bus_display_wnd );
+	common_window_destroy( HEAP_TAG_DISPLAY, s_bus_display_wnd );
 }
 
 
@@ -350,19 +419,22 @@ void bus_display_show()
 }
 
 
-void bus_display_handle_msg_tuple( Tuple* msg_tuple )
+/**
+ * BUS_DATA has to be handed over in the buffer returned by bus_display_get_bus_data_buffer().
+ */
+void bus_display_handle_msg( uint32_t key, const char* data, int length )
 {
-    switch( msg_tuple->key )
+    switch( key )
     {
         case BUS_STOP_DATA:
         {
-            parse_first_bus_stop( msg_tuple->value->cstring );
+            parse_first_bus_stop( data, length );
         }            
         break;
         case BUS_DATA:
         {
             s_current_page = 0; // reset page to first, if new data arrives
-            parse_bus_data( msg_tuple->value->cstring );
+            parse_bus_data( length );
         }
         break;
         default:
@@ -371,6 +443,23 @@ void bus_display_handle_msg_tuple( Tuple* msg_tuple )
     }
 }
 
+/**
+ * The back buffer, which the next BUS_DATA payload is received into.
+ */
+char* bus_display_get_bus_data_buffer()
+{
+    return s_bus_data_back;
+}
+
+/**
+ * The fields of the BUS_DATA payload that was handled last, terminated in place and valid until
+ * the next one arrives.
+ */
+const CsvTokens* bus_display_get_bus_data_tokens()
+{
+    return &s_bus_board.tokens;
+}
+
 
 void bus_display_set_update_status_text( const char* status_text )
 {
@@ -9,6 +9,8 @@ void bus_display_destroy();
 
 void bus_display_show();
 
-void bus_display_handle_msg_tuple( Tuple* msg_tuple );
+void bus_display_handle_msg( uint32_t key, const char* data, int length );
+char* bus_display_get_bus_data_buffer();
+const CsvTokens* bus_display_get_bus_data_tokens();
 
 void bus_display_set_update_status_text( const char* status_text );
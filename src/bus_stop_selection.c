@@ -1,25 +1,27 @@
 #include "bus_stop_selection.h"
+#include "prewarm.h"
 
 //==================================================================================================
 //==================================================================================================
 // Definitions
 
-#define NUM_BUS_STOPS             7
+#define NUM_BUS_STOPS            NUM_ROWS
 
-#define BUS_STOP_MARGIN_TOP      28
-#define BUS_STOP_MARGIN_LEFT      3
-#define BUS_STOP_HEIGHT          16
-#define BUS_STOP_NAME_WIDTH     100
 #define BUS_STOP_DIST_WIDTH      38
+#define BUS_STOP_NAME_WIDTH      ( ROW_WIDTH - BUS_STOP_DIST_WIDTH )
 
 #define BUS_STOP_NAME_SIZE       32
 #define BUS_STOP_DIST_SIZE        8
 
+#define BUS_STOP_FIELDS_PER_ENTRY 3
+
 
 //==================================================================================================
 //==================================================================================================
 // Variables
 
+// the window and its layers only exist while the window is on the window stack, the bus stop
+// data and status text below are kept independently of it
 static Window* s_bus_stop_sel_wnd = NULL;
 static TextLayer* s_bus_stop_sel_title = NULL;
 static TextLayer* s_bus_stop_sel_status = NULL;
@@ -35,6 +37,9 @@ struct {
 } s_bus_stops[ NUM_BUS_STOPS ];
 
 static int s_selected_bus_stop_idx = 0;
+// rows with data, the cursor never moves past them; row 0 is always "GPS closest"
+static int s_num_bus_stops = 1;
+static const char* s_status_text = "No updates, yet.";
 
 
 //==================================================================================================
@@ -43,18 +48,18 @@ static int s_selected_bus_stop_idx = 0;
 
 GRect bus_stop_name_rect( int index )
 {
-    return GRect( BUS_STOP_MARGIN_LEFT,
-                  BUS_STOP_MARGIN_TOP + index * BUS_STOP_HEIGHT,
+    return GRect( ROW_LEFT,
+                  ROW_TOP + index * ROW_HEIGHT,
                   BUS_STOP_NAME_WIDTH,
-                  BUS_STOP_HEIGHT );
+                  ROW_HEIGHT );
 }
 
 GRect bus_stop_dist_rect( int index )
 {
-    return GRect( BUS_STOP_MARGIN_LEFT + BUS_STOP_NAME_WIDTH,
-                  BUS_STOP_MARGIN_TOP + index * BUS_STOP_HEIGHT,
+    return GRect( ROW_LEFT + BUS_STOP_NAME_WIDTH,
+                  ROW_TOP + index * ROW_HEIGHT,
                   BUS_STOP_DIST_WIDTH,
-                  BUS_STOP_HEIGHT );
+                  ROW_HEIGHT );
 }
 
 
@@ -62,10 +67,10 @@ void create_bus_stop_text_layers()
 {
     for( int i = 0; i != NUM_BUS_STOPS; ++i )
     {
-        common_create_text_layer( &s_bus_stops[ i ].name, s_bus_stop_sel_wnd,
+        common_create_text_layer( HEAP_TAG_SELECTION, &s_bus_stops[ i ].name, s_bus_stop_sel_wnd,
                                   bus_stop_name_rect( i ), GColorWhite, GColorBlack,
                                   FONT_KEY_GOTHIC_14, GTextAlignmentLeft );
-        common_create_text_layer( &s_bus_stops[ i ].dist, s_bus_stop_sel_wnd,
+        common_create_text_layer( HEAP_TAG_SELECTION, &s_bus_stops[ i ].dist, s_bus_stop_sel_wnd,
                                   bus_stop_dist_rect( i ), GColorWhite, GColorBlack,
                                   FONT_KEY_GOTHIC_14, GTextAlignmentRight );
     }
@@ -75,8 +80,8 @@ void destroy_bus_stop_text_layers()
 {
     for( int i = 0; i != NUM_BUS_STOPS; ++i )
     {
-        text_layer_destroy( s_bus_stops[ i ].name );
-        text_layer_destroy( s_bus_stops[ i ].dist );
+        common_destroy_text_layer( HEAP_TAG_SELECTION, s_bus_stops[ i ].name );
+        common_destroy_text_layer( HEAP_TAG_SELECTION, s_bus_stops[ i ].dist );
     }
 }
 
@@ -90,19 +95,24 @@ void update_bus_stop_selection( int relative_change )
        
     int new_selected_idx = s_selected_bus_stop_idx + relative_change;
         
-    if( new_selected_idx >= 0 && new_selected_idx < NUM_BUS_STOPS )
+    if( new_selected_idx >= 0 && new_selected_idx < s_num_bus_stops )
     {       
         s_selected_bus_stop_idx += relative_change;
     }
         
-    text_layer_set_background_color( s_bus_stops[ s_selected_bus_stop_idx ].name, GColorDarkCandyAppleRed );
-    text_layer_set_background_color( s_bus_stops[ s_selected_bus_stop_idx ].dist, GColorDarkCandyAppleRed );
+    text_layer_set_background_color( s_bus_stops[ s_selected_bus_stop_idx ].name, COLOR_ACCENT );
+    text_layer_set_background_color( s_bus_stops[ s_selected_bus_stop_idx ].dist, COLOR_ACCENT );
     text_layer_set_text_color( s_bus_stops[ s_selected_bus_stop_idx ].name, GColorWhite );
     text_layer_set_text_color( s_bus_stops[ s_selected_bus_stop_idx ].dist, GColorWhite );
 }
 
 void apply_bus_stop_data()
 {
+    if( s_bus_stop_sel_wnd == NULL )
+    {
+        return;
+    }
+    
     for( int i = 0; i != NUM_BUS_STOPS; ++i )
     {
         text_layer_set_text( s_bus_stops[ i ].name, s_bus_stops[ i ].name_string );
@@ -110,37 +120,42 @@ void apply_bus_stop_data()
     }
 }
 
-void parse_bus_stop_data( const char* bus_stop_data )
+void parse_bus_stop_data( const char* bus_stop_data, int length )
 {
     APP_LOG( APP_LOG_LEVEL_INFO, "%s", bus_stop_data );
     
-    char id_buffer[ 8 ];
+    // every entry is name;distance;id, the first one is the requested bus stop if there is one
+    CsvSpan spans[ BUS_STOP_FIELDS_PER_ENTRY * NUM_BUS_STOPS ];
+    CsvTokens tokens;
+    common_csv_tokenize( &tokens, bus_stop_data, length, spans, BUS_STOP_FIELDS_PER_ENTRY * NUM_BUS_STOPS );
     
-    for( int i = 0; i != NUM_BUS_STOPS; ++i )
+    const int first_entry = common_get_current_bus_stop_id() != -1 ? 1 : 0;
+    const int num_entries = tokens.num_spans / BUS_STOP_FIELDS_PER_ENTRY - first_entry;
+    s_num_bus_stops = 1 + max( 0, min( num_entries, NUM_BUS_STOPS - 1 ) );
+    
+    snprintf( s_bus_stops[ 0 ].name_string, sizeof( "GPS closest" ), "GPS closest" );
+    snprintf( s_bus_stops[ 0 ].dist_string, sizeof( " " ), " " );
+    s_bus_stops[ 0 ].id = -1;
+    
+    for( int i = 1; i != NUM_BUS_STOPS; ++i )
+    {
+        const int first_span = ( first_entry + i - 1 ) * BUS_STOP_FIELDS_PER_ENTRY;
+        
+        common_csv_copy( &tokens, first_span,     s_bus_stops[ i ].name_string, BUS_STOP_NAME_SIZE );
+        common_csv_copy( &tokens, first_span + 1, s_bus_stops[ i ].dist_string, BUS_STOP_DIST_SIZE );
+        s_bus_stops[ i ].id = common_csv_get_int( &tokens, first_span + 2, -1 );
+    }
+    
+    // the list got shorter, move the cursor from an empty row to the last one with data
+    if( s_selected_bus_stop_idx >= s_num_bus_stops )
     {
-        if( i != 0 && *bus_stop_data != '\0' )
+        if( s_bus_stop_sel_wnd != NULL )
         {
-            bus_stop_data = common_read_csv_item( bus_stop_data, s_bus_stops[ i ].name_string, BUS_STOP_NAME_SIZE );
-            bus_stop_data = common_read_csv_item( bus_stop_data, s_bus_stops[ i ].dist_string, BUS_STOP_DIST_SIZE );
-            bus_stop_data = common_read_csv_item( bus_stop_data, id_buffer, 8 );
-            s_bus_stops[ i ].id = atoi( id_buffer );
+            update_bus_stop_selection( s_num_bus_stops - 1 - s_selected_bus_stop_idx );
         }
         else
         {
-            // we need to consume the first entry if we requested a bus stop
-            if( common_get_current_bus_stop_id() != -1 )
-            {
-                bus_stop_data = common_find_next_separator( bus_stop_data, ';' );
-                ++bus_stop_data;
-                bus_stop_data = common_find_next_separator( bus_stop_data, ';' );
-                ++bus_stop_data;
-                bus_stop_data = common_find_next_separator( bus_stop_data, ';' );
-                ++bus_stop_data;
-            }
-            
-            snprintf( s_bus_stops[ i ].name_string, sizeof( "GPS closest" ), "GPS closest" );
-            snprintf( s_bus_stops[ i ].dist_string, sizeof( " " ), " " );
-            s_bus_stops[ i ].id = -1;
+            s_selected_bus_stop_idx = s_num_bus_stops - 1;
         }
     }
     
@@ -165,14 +180,27 @@ void bus_stop_selection_next_page( ClickRecognizerRef recognizer, void* context
 void bus_stop_selection_make_choice( ClickRecognizerRef recognizer, void* context )
 {
     common_set_current_bus_stop_id( s_bus_stops[ s_selected_bus_stop_idx ].id );
-    common_get_update_callback()();
+    common_get_update_callback()( REQUEST_PRIORITY_USER );
     window_stack_pop( true );
 }
 
+void bus_stop_selection_toggle_commute_slot( ClickRecognizerRef recognizer, void* context )
+{
+    if( prewarm_toggle_slot_now( s_bus_stops[ s_selected_bus_stop_idx ].id ) )
+    {
+        vibes_short_pulse();
+    }
+    else
+    {
+        vibes_double_pulse();
+    }
+}
+
 
 void bus_stop_selection_click_provider( Window* window )
 {
     window_single_click_subscribe( BUTTON_ID_SELECT, bus_stop_selection_make_choice );
+    window_long_click_subscribe( BUTTON_ID_SELECT, 0, bus_stop_selection_toggle_commute_slot, NULL );
     
     window_single_click_subscribe( BUTTON_ID_UP, bus_stop_selection_previous_page );
     window_single_click_subscribe( BUTTON_ID_DOWN, bus_stop_selection_next_page );    
@@ -185,15 +213,15 @@ void bus_stop_selection_click_provider( Window* window )
 
 void bus_stop_selection_create_resources()
 {
-    common_create_text_layer( &s_bus_stop_sel_title, s_bus_stop_sel_wnd, GRect( 24, 0, 120, 20 ),
-                              GColorDarkCandyAppleRed, GColorWhite, FONT_KEY_GOTHIC_18_BOLD,
+    common_create_text_layer( HEAP_TAG_SELECTION, &s_bus_stop_sel_title, s_bus_stop_sel_wnd, TITLE_RECT,
+                              COLOR_ACCENT, GColorWhite, FONT_KEY_GOTHIC_18_BOLD,
                               GTextAlignmentLeft );
     text_layer_set_text( s_bus_stop_sel_title, "Select bus stop" );
     
-    common_create_h_icon( &s_bus_stop_sel_banner, s_bus_stop_sel_wnd );
+    common_create_h_icon( HEAP_TAG_SELECTION, &s_bus_stop_sel_banner, s_bus_stop_sel_wnd );
         
-    common_create_text_layer( &s_bus_stop_sel_status, s_bus_stop_sel_wnd, GRect( 0, 148, 144, 20 ), GColorDarkCandyAppleRed, GColorWhite, FONT_KEY_GOTHIC_14, GTextAlignmentCenter );
-    text_layer_set_text( s_bus_stop_sel_status, "No updates, yet." );
+    common_create_text_layer( HEAP_TAG_SELECTION, &s_bus_stop_sel_status, s_bus_stop_sel_wnd, STATUS_RECT, COLOR_ACCENT, GColorWhite, FONT_KEY_GOTHIC_14, GTextAlignmentCenter );
+    text_layer_set_text( s_bus_stop_sel_status, s_status_text );
     
     create_bus_stop_text_layers();    
 }
@@ -201,62 +229,61 @@ void bus_stop_selection_create_resources()
 void bus_stop_selection_destroy_resources()
 {   
     destroy_bus_stop_text_layers();
-    text_layer_destroy( s_bus_stop_sel_status );
-    bitmap_layer_destroy( s_bus_stop_sel_banner );
-    text_layer_destroy( s_bus_stop_sel_title );   
+    common_destroy_text_layer( HEAP_TAG_SELECTION, s_bus_stop_sel_status );
+    common_destroy_h_icon( HEAP_TAG_SELECTION, s_bus_stop_sel_banner );
+    common_destroy_text_layer( HEAP_TAG_SELECTION, s_bus_stop_sel_title );   
 }
 
 
 void bus_stop_selection_window_load()
 {
+    bus_stop_selection_create_resources();
+    apply_bus_stop_data(); // to show data that arrived while the window did not exist
     update_bus_stop_selection( -s_selected_bus_stop_idx ); // reset to index 0
 }
 
-
-
-//==================================================================================================
-//==================================================================================================
-// Interface functions
-
-void bus_stop_selection_create()
+void bus_stop_selection_window_unload()
 {
-    s_bus_stop_sel_wnd = window_create();
-    bus_stop_selection_create_resources();
-
-    window_set_window_handlers( s_bus_stop_sel_wnd, ( WindowHandlers )
-    {
-        .load = bus_stop_selection_window_load
-    } );
+    bus_stop_selection_destroy_resources();
     
-    window_set_click_config_provider( s_bus_stop_sel_wnd,
-                                      ( ClickConfigProvider ) bus_stop_selection_click_provider );
+    common_window_destroy( HEAP_TAG_SELECTION, s_bus_stop_sel_wnd );
+    s_bus_stop_sel_wnd = NULL;
 }
 
-void bus_stop_selection_destroy()
-{
-    bus_stop_selection_destroy_resources();
-    window_destroy( s_bus_stop_sel_wnd );
-}
 
 
+//==================================================================================================
+//==================================================================================================
+// Interface functions
+
 void bus_stop_selection_show()
 {
-    if( s_bus_stop_sel_wnd )
+    // most sessions never open the selection window, so it is only built on demand
+    if( s_bus_stop_sel_wnd == NULL )
     {
+        s_bus_stop_sel_wnd = common_window_create( HEAP_TAG_SELECTION );
+        
+        window_set_window_handlers( s_bus_stop_sel_wnd, ( WindowHandlers )
+        {
+            .load = bus_stop_selection_window_load,
+            .unload = bus_stop_selection_window_unload
+        } );
+        
+        window_set_click_config_provider( s_bus_stop_sel_wnd,
+                                          ( ClickConfigProvider ) bus_stop_selection_click_provider );
+        
         window_stack_push( s_bus_stop_sel_wnd, true );
-        apply_bus_stop_data(); // to show data that might have arrived before window
-                               // was shown for the first time
     }
 }
     
 
-void bus_stop_selection_handle_msg_tuple( Tuple* msg_tuple )
+void bus_stop_selection_handle_msg( uint32_t key, const char* data, int length )
 {
-    switch( msg_tuple->key )
+    switch( key )
     {
         case BUS_STOP_DATA:
         {
-            parse_bus_stop_data( msg_tuple->value->cstring );
+            parse_bus_stop_data( data, length );
         }
         break;
         default:
@@ -267,5 +294,10 @@ void bus_stop_selection_handle_msg_tuple( Tuple* msg_tuple )
 
 void bus_stop_selection_set_update_status_text( const char* status_text )
 {
-    text_layer_set_text( s_bus_stop_sel_status, status_text );
+    s_status_text = status_text;
+    
+    if( s_bus_stop_sel_wnd != NULL )
+    {
+        text_layer_set_text( s_bus_stop_sel_status, status_text );
+    }
 }
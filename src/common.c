@@ -4,9 +4,40 @@
 //==================================================================================================
 // Variables
 
-static GenericCallback s_update_callback = NULL;
+static UpdateCallback s_update_callback = NULL;
 static int s_current_bus_stop_id = -1;
 
+static const char* s_heap_tag_names[ HEAP_NUM_TAGS ] = {
+    "display", "selection", "stats", "messaging", "resources"
+};
+
+// bytes currently attributed to each tag and the high-water mark thereof
+static struct {
+    int32_t current;
+    int32_t peak;
+} s_heap_usage[ HEAP_NUM_TAGS ];
+
+static size_t s_heap_peak_used = 0;
+
+// Decoded bitmap resources are shared by all windows. They are loaded on first use and freed
+// when the last user releases them. Acquiring more distinct bitmaps than the cache holds fails.
+#define BITMAP_CACHE_SIZE   2
+
+static struct {
+    uint32_t resource_id;
+    GBitmap* bitmap;
+    int ref_count;
+} s_bitmap_cache[ BITMAP_CACHE_SIZE ];
+
+// System fonts are owned by the firmware and never freed, so caching the handles merely saves
+// the lookup for each of the text layers
+#define FONT_CACHE_SIZE     4
+
+static struct {
+    const char* font_key;
+    GFont font;
+} s_font_cache[ FONT_CACHE_SIZE ];
+
 
 //==================================================================================================
 //==================================================================================================
@@ -17,11 +48,11 @@ void update_proc( Layer* layer, GContext* context )
     // @TODO reusing this function for every h_icon is a dirty thing to do, since it must be
     //       ensured that the draw calls below fit every window that has an h_icon 
     
-    graphics_context_set_fill_color( context, GColorDarkCandyAppleRed );
-    graphics_fill_rect( context, GRect( 0, 0, 144, 25 ), 0, GCornerNone );
+    graphics_context_set_fill_color( context, COLOR_ACCENT );
+    graphics_fill_rect( context, GRect( 0, 0, SCREEN_WIDTH, HEADER_HEIGHT ), 0, GCornerNone );
     
     graphics_context_set_fill_color( context, GColorWhite );
-    graphics_fill_rect( context, GRect( 0, 25, 144, 143 ), 0, GCornerNone );
+    graphics_fill_rect( context, GRect( 0, HEADER_HEIGHT, SCREEN_WIDTH, SCREEN_HEIGHT - HEADER_HEIGHT ), 0, GCornerNone );
 }
 
 
@@ -29,35 +60,215 @@ void update_proc( Layer* layer, GContext* context )
 //==================================================================================================
 // Interface functions
 
-void common_set_update_callback( GenericCallback callback )
+void common_set_update_callback( UpdateCallback callback )
 {
 	s_update_callback = callback;
 }
 
-GenericCallback common_get_update_callback()
+UpdateCallback common_get_update_callback()
 {
 	return s_update_callback;
 }
 
 
-void common_create_text_layer( TextLayer** text_layer, Window* window, GRect rect, GColor back_color, GColor text_color, const char* font_name, GTextAlignment text_align )
+/**
+ * The SDK does not let us hook into its allocator, so allocations are attributed by sampling
+ * heap_bytes_used() before (common_heap_mark) and after (common_heap_account) they are made.
+ * Frees work the same way and simply yield a negative delta.
+ */
+size_t common_heap_mark()
+{
+    return heap_bytes_used();
+}
+
+void common_heap_account( HeapTag tag, size_t mark )
 {
+    const size_t used = heap_bytes_used();
+    
+    s_heap_usage[ tag ].current += ( int32_t ) used - ( int32_t ) mark;
+    s_heap_usage[ tag ].peak = max( s_heap_usage[ tag ].peak, s_heap_usage[ tag ].current );
+    s_heap_peak_used = max( s_heap_peak_used, used );
+}
+
+void common_heap_format_report( char* target, int max_bytes )
+{
+    int written = snprintf( target, max_bytes, "heap %d peak %d free %d\n",
+                            ( int ) heap_bytes_used(), ( int ) s_heap_peak_used,
+                            ( int ) heap_bytes_free() );
+    
+    for( int i = 0; i != HEAP_NUM_TAGS && written < max_bytes; ++i )
+    {
+        written += snprintf( target + written, max_bytes - written, "%s: %d peak %d\n",
+                             s_heap_tag_names[ i ], ( int ) s_heap_usage[ i ].current,
+                             ( int ) s_heap_usage[ i ].peak );
+    }
+}
+
+void common_heap_log_report()
+{
+    APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] Heap used: %d bytes, peak %d bytes, free %d bytes.",
+             ( int ) heap_bytes_used(), ( int ) s_heap_peak_used, ( int ) heap_bytes_free() );
+    
+    for( int i = 0; i != HEAP_NUM_TAGS; ++i )
+    {
+        APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus]   %s: %d bytes, peak %d bytes", s_heap_tag_names[ i ],
+                 ( int ) s_heap_usage[ i ].current, ( int ) s_heap_usage[ i ].peak );
+    }
+}
+
+
+void* common_malloc( HeapTag tag, size_t size )
+{
+    const size_t mark = common_heap_mark();
+    void* ptr = malloc( size );
+    common_heap_account( tag, mark );
+    
+    return ptr;
+}
+
+void common_free( HeapTag tag, void* ptr )
+{
+    const size_t mark = common_heap_mark();
+    free( ptr );
+    common_heap_account( tag, mark );
+}
+
+
+GBitmap* common_acquire_bitmap( uint32_t resource_id )
+{
+    int free_idx = -1;
+    
+    for( int i = 0; i != BITMAP_CACHE_SIZE; ++i )
+    {
+        if( s_bitmap_cache[ i ].ref_count > 0 && s_bitmap_cache[ i ].resource_id == resource_id )
+        {
+            ++s_bitmap_cache[ i ].ref_count;
+            return s_bitmap_cache[ i ].bitmap;
+        }
+        
+        if( s_bitmap_cache[ i ].ref_count == 0 && free_idx == -1 )
+        {
+            free_idx = i;
+        }
+    }
+    
+    if( free_idx == -1 )
+    {
+        // an unshared bitmap could never be released and would leak, so the cache has to grow
+        // with the number of distinct bitmaps in use
+        APP_LOG( APP_LOG_LEVEL_ERROR, "[ACbus] Bitmap cache full, increase BITMAP_CACHE_SIZE for resource %d.",
+                 ( int ) resource_id );
+        return NULL;
+    }
+    
+    const size_t mark = common_heap_mark();
+    GBitmap* bitmap = gbitmap_create_with_resource( resource_id );
+    common_heap_account( HEAP_TAG_RESOURCES, mark );
+    
+    if( bitmap == NULL )
+    {
+        return NULL;
+    }
+    
+    s_bitmap_cache[ free_idx ].resource_id = resource_id;
+    s_bitmap_cache[ free_idx ].bitmap = bitmap;
+    s_bitmap_cache[ free_idx ].ref_count = 1;
+    
+    return bitmap;
+}
+
+void common_release_bitmap( uint32_t resource_id )
+{
+    for( int i = 0; i != BITMAP_CACHE_SIZE; ++i )
+    {
+        if( s_bitmap_cache[ i ].ref_count > 0 && s_bitmap_cache[ i ].resource_id == resource_id )
+        {
+            if( --s_bitmap_cache[ i ].ref_count == 0 )
+            {
+                const size_t mark = common_heap_mark();
+                gbitmap_destroy( s_bitmap_cache[ i ].bitmap );
+                common_heap_account( HEAP_TAG_RESOURCES, mark );
+                
+                s_bitmap_cache[ i ].bitmap = NULL;
+            }
+            return;
+        }
+    }
+}
+
+GFont common_get_font( const char* font_key )
+{
+    for( int i = 0; i != FONT_CACHE_SIZE; ++i )
+    {
+        if( s_font_cache[ i ].font_key == NULL )
+        {
+            s_font_cache[ i ].font_key = font_key;
+            s_font_cache[ i ].font = fonts_get_system_font( font_key );
+            return s_font_cache[ i ].font;
+        }
+        
+        // font keys are string literals, but not necessarily the same copy in every translation unit
+        if( strcmp( s_font_cache[ i ].font_key, font_key ) == 0 )
+        {
+            return s_font_cache[ i ].font;
+        }
+    }
+    
+    return fonts_get_system_font( font_key );
+}
+
+
+Window* common_window_create( HeapTag tag )
+{
+    const size_t mark = common_heap_mark();
+    Window* window = window_create();
+    common_heap_account( tag, mark );
+    
+    return window;
+}
+
+void common_window_destroy( HeapTag tag, Window* window )
+{
+    const size_t mark = common_heap_mark();
+    window_destroy( window );
+    common_heap_account( tag, mark );
+    
+    // whatever is left for the tag after a window is gone is either shared or a leak
+    common_heap_log_report();
+}
+
+
+void common_create_text_layer( HeapTag tag, TextLayer** text_layer, Window* window, GRect rect, GColor back_color, GColor text_color, const char* font_name, GTextAlignment text_align )
+{
+    const size_t mark = common_heap_mark();
     *text_layer = text_layer_create( rect );
+    common_heap_account( tag, mark );
     
     text_layer_set_background_color( *text_layer, back_color );
     text_layer_set_text_color( *text_layer, text_color );
-    text_layer_set_font( *text_layer, fonts_get_system_font( font_name ) );
+    text_layer_set_font( *text_layer, common_get_font( font_name ) );
     text_layer_set_text_alignment( *text_layer, text_align );
     text_layer_set_text( *text_layer, "" );
     
     layer_add_child( window_get_root_layer( window ), text_layer_get_layer( *text_layer ) ); 
 }
 
+void common_destroy_text_layer( HeapTag tag, TextLayer* text_layer )
+{
+    const size_t mark = common_heap_mark();
+    text_layer_destroy( text_layer );
+    common_heap_account( tag, mark );
+}
+
 
-void common_create_h_icon( BitmapLayer** bitmap_layer, Window* window )
+void common_create_h_icon( HeapTag tag, BitmapLayer** bitmap_layer, Window* window )
 {
-    GBitmap* h_icon = gbitmap_create_with_resource( RESOURCE_ID_ICON_H );
-    *bitmap_layer = bitmap_layer_create( GRect( 3, 3, 18, 18 ) );
+    GBitmap* h_icon = common_acquire_bitmap( RESOURCE_ID_ICON_H );
+    
+    const size_t mark = common_heap_mark();
+    *bitmap_layer = bitmap_layer_create( ICON_RECT );
+    common_heap_account( tag, mark );
+    
     bitmap_layer_set_compositing_mode( *bitmap_layer, GCompOpSet );
     bitmap_layer_set_background_color( *bitmap_layer, GColorClear );
     bitmap_layer_set_bitmap( *bitmap_layer, h_icon );
@@ -66,6 +277,26 @@ void common_create_h_icon( BitmapLayer** bitmap_layer, Window* window )
     layer_set_update_proc( window_get_root_layer ( window ), update_proc );    
 }
 
+void common_destroy_h_icon( HeapTag tag, BitmapLayer* bitmap_layer )
+{
+    const size_t mark = common_heap_mark();
+    bitmap_layer_destroy( bitmap_layer );
+    common_heap_account( tag, mark );
+    
+    common_release_bitmap( RESOURCE_ID_ICON_H );
+}
+
+
+uint32_t common_time_ms()
+{
+    time_t seconds = 0;
+    uint16_t milliseconds = 0;
+    time_ms( &seconds, &milliseconds );
+    
+    // wraps around after ~50 days, which is fine for measuring durations
+    return ( uint32_t ) seconds * 1000 + milliseconds;
+}
+
 
 void common_set_current_bus_stop_id( int id )
 {
@@ -110,8 +341,185 @@ const char* common_read_csv_item( const char* csv_data, char* target, int max_by
 }
 
 
+/**
+ * Strings longer than PERSIST_DATA_MAX_LENGTH are split into chunks that are stored under
+ * consecutive keys, starting with first_key. Unused keys of the range are deleted.
+ */
+void common_persist_write_string( uint32_t first_key, int num_keys, const char* string )
+{
+    const int num_bytes = strlen( string ) + 1; // include the trailing '\0' char
+    
+    for( int i = 0; i != num_keys; ++i )
+    {
+        const int offset = i * PERSIST_DATA_MAX_LENGTH;
+        
+        if( offset < num_bytes )
+        {
+            persist_write_data( first_key + i, string + offset,
+                                min( num_bytes - offset, PERSIST_DATA_MAX_LENGTH ) );
+        }
+        else if( persist_exists( first_key + i ) )
+        {
+            persist_delete( first_key + i );
+        }
+    }
+}
+
+/**
+ * Counterpart of common_persist_write_string. The result is always '\0' terminated, and
+ * silently truncated if target is too small. Returns the length of the string read.
+ */
+int common_persist_read_string( uint32_t first_key, int num_keys, char* target, int max_bytes )
+{
+    int num_bytes = 0;
+    
+    for( int i = 0; i != num_keys && num_bytes < max_bytes; ++i )
+    {
+        if( !persist_exists( first_key + i ) )
+        {
+            break;
+        }
+        
+        const int chunk_bytes = persist_read_data( first_key + i, target + num_bytes,
+                                                   min( max_bytes - num_bytes, PERSIST_DATA_MAX_LENGTH ) );
+        if( chunk_bytes <= 0 )
+        {
+            break;
+        }
+        num_bytes += chunk_bytes;
+    }
+    
+    target[ min( num_bytes, max_bytes - 1 ) ] = '\0';
+    return strlen( target );
+}
+
+
+/**
+ * Finds all fields in a single bytewise pass over [csv_data, csv_data + length), so no byte of
+ * the payload is read twice. If terminate is set, every separator is overwritten with '\0'.
+ */
+void tokenize_csv( CsvTokens* tokens, const char* csv_data, int length, CsvSpan* spans, int max_spans,
+                   bool terminate )
+{
+    tokens->data = csv_data;
+    tokens->spans = spans;
+    tokens->num_spans = 0;
+    
+    // an empty payload has no fields rather than a single empty one
+    if( length <= 0 )
+    {
+        return;
+    }
+    
+    const char* field = csv_data;
+    const char* cursor = csv_data;
+    const char* end = csv_data + length;
+    // counted in a local, so it is not written back to the tokens for every field
+    int num_spans = 0;
+    
+    while( num_spans != max_spans )
+    {
+        while( cursor != end && *cursor != ';' )
+        {
+            ++cursor;
+        }
+        
+        spans[ num_spans ].offset = field - csv_data;
+        spans[ num_spans ].length = cursor - field;
+        ++num_spans;
+        
+        if( cursor == end )
+        {
+            break;
+        }
+        
+        if( terminate )
+        {
+            *( char* ) cursor = '\0';
+        }
+        field = ++cursor;
+    }
+    
+    tokens->num_spans = num_spans;
+}
+
+void common_csv_tokenize( CsvTokens* tokens, const char* csv_data, int length, CsvSpan* spans, int max_spans )
+{
+    tokenize_csv( tokens, csv_data, length, spans, max_spans, false );
+}
+
+/**
+ * Like common_csv_tokenize, but also terminates every field in the payload itself, so fields can
+ * be used in place with common_csv_get_string. csv_data[ length ] has to be '\0' already.
+ */
+void common_csv_tokenize_in_place( CsvTokens* tokens, char* csv_data, int length, CsvSpan* spans, int max_spans )
+{
+    tokenize_csv( tokens, csv_data, length, spans, max_spans, true );
+}
+
+int common_csv_get_int( const CsvTokens* tokens, int index, int fallback )
+{
+    if( index >= tokens->num_spans || tokens->spans[ index ].length == 0 )
+    {
+        return fallback;
+    }
+    
+    const char* cursor = tokens->data + tokens->spans[ index ].offset;
+    const char* end_cursor = cursor + tokens->spans[ index ].length;
+    const bool negative = *cursor == '-';
+    int value = 0;
+    
+    if( negative )
+    {
+        ++cursor;
+    }
+    
+    // like atoi, parsing stops at the first non-digit
+    for( ; cursor != end_cursor && *cursor >= '0' && *cursor <= '9'; ++cursor )
+    {
+        value = value * 10 + ( *cursor - '0' );
+    }
+    
+    return negative ? -value : value;
+}
+
+int common_csv_copy( const CsvTokens* tokens, int index, char* target, int max_bytes )
+{
+    if( index >= tokens->num_spans )
+    {
+        target[ 0 ] = '\0';
+        return 0;
+    }
+    
+    const CsvSpan span = tokens->spans[ index ];
+    const int num_bytes = min( span.length, max_bytes - 1 );
+    
+    memcpy( target, tokens->data + span.offset, num_bytes );
+    target[ num_bytes ] = '\0';
+    
+    // like snprintf, the full length tells the caller whether the field was truncated
+    return span.length;
+}
+
+/**
+ * Only for payloads tokenized with common_csv_tokenize_in_place. Missing fields are empty.
+ */
+const char* common_csv_get_string( const CsvTokens* tokens, int index )
+{
+    if( index >= tokens->num_spans )
+    {
+        return "";
+    }
+    
+    return tokens->data + tokens->spans[ index ].offset;
+}
+
 const char* common_app_message_result_to_string( AppMessageResult result )
 {
+#ifdef ACBUS_NO_LOGGING
+    // the names are only ever logged, spare the string table in size-tuned builds
+    return "";
+#else
     switch( result )
     {
         case APP_MSG_OK:                return "APP_MSG_OK";                break;
@@ -132,4 +540,5 @@ const char* common_app_message_result_to_string( AppMessageResult result )
     }
     
     return "";
+#endif
 }
@@ -2,29 +2,109 @@
 
 #include <pebble.h>
 
+#include "layout.h"
+
+// Size-tuned builds compile out all logging, see --strip-logging in wscript. The arguments stay
+// referenced in an unevaluated context, so values that are only logged do not trigger warnings.
+#ifdef ACBUS_NO_LOGGING
+#undef APP_LOG
+#define APP_LOG( level, fmt, ... ) ( ( void ) sizeof( snprintf( NULL, 0, fmt, ## __VA_ARGS__ ) ) )
+#endif
+
 // App message ids
 #define BUS_STOP_DATA            0
 #define BUS_DATA                 1
 #define REQ_BUS_STOP_ID          2
 #define REQ_UPDATE_BUS_STOP_LIST 3
+#define PHONE_TIMINGS            4
+#define PHONE_STATS              5
+#define REQ_GENERATION           6
+#define GENERATION               7
+#define REQ_LINE_FILTER          8
+#define REQ_MAX_BUSES            9
+#define REQ_MAX_BUS_STOPS       10
+
+// Persistent storage keys
+#define PERSIST_KEY_STATS                1
+#define PERSIST_KEY_PREWARM_SLOTS        2
+#define PERSIST_KEY_PREWARM_BUDGET       3
+#define PERSIST_KEY_PREWARM_META         4
+#define PERSIST_KEY_LINE_FILTERS         5
+#define PERSIST_KEY_PREWARM_STOP_DATA   10  // spans PREWARM_STOP_DATA_KEYS keys
+#define PERSIST_KEY_PREWARM_BUS_DATA    20  // spans PREWARM_BUS_DATA_KEYS keys
 
 // Typedefs
 typedef void( *GenericCallback )( void );
+typedef void( *MessageDataHandler )( uint32_t key, const char* data, int length );
+
+// Update requests of higher priority pre-empt those of lower priority
+typedef enum {
+    REQUEST_PRIORITY_PERIODIC = 0,
+    REQUEST_PRIORITY_TAP,
+    REQUEST_PRIORITY_USER
+} RequestPriority;
+
+typedef void( *UpdateCallback )( RequestPriority priority );
+
+// Owners of heap allocations, see common_heap_account
+typedef enum {
+    HEAP_TAG_DISPLAY = 0,
+    HEAP_TAG_SELECTION,
+    HEAP_TAG_STATS,
+    HEAP_TAG_MESSAGING,
+    HEAP_TAG_RESOURCES,
+    HEAP_NUM_TAGS
+} HeapTag;
+
+// A field of a ';' separated payload, relative to the start of the payload
+typedef struct {
+    uint16_t offset;
+    uint16_t length;
+} CsvSpan;
+
+// All fields of a payload, which has to outlive the tokens, see common_csv_tokenize
+typedef struct {
+    const char* data;
+    CsvSpan* spans;
+    int num_spans;
+} CsvTokens;
 
 // Functions
 #ifndef min
 #define min(a,b) (((a) < (b)) ? (a) : (b))
 #endif
+#ifndef max
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+#endif
+
+
+void common_set_update_callback( UpdateCallback callback );
+UpdateCallback common_get_update_callback();
+
+size_t common_heap_mark();
+void common_heap_account( HeapTag tag, size_t mark );
+void common_heap_format_report( char* target, int max_bytes );
+void common_heap_log_report();
 
+void* common_malloc( HeapTag tag, size_t size );
+void common_free( HeapTag tag, void* ptr );
 
-void common_set_update_callback( GenericCallback callback );
-GenericCallback common_get_update_callback();
+GBitmap* common_acquire_bitmap( uint32_t resource_id );
+void common_release_bitmap( uint32_t resource_id );
+GFont common_get_font( const char* font_key );
 
-void common_create_text_layer( TextLayer** text_layer, Window* window, GRect rect, GColor back_color,
+Window* common_window_create( HeapTag tag );
+void common_window_destroy( HeapTag tag, Window* window );
+
+void common_create_text_layer( HeapTag tag, TextLayer** text_layer, Window* window, GRect rect, GColor back_color,
 							   GColor text_color, const char* font_name, GTextAlignment text_align );
+void common_destroy_text_layer( HeapTag tag, TextLayer* text_layer );
+
+void common_create_h_icon( HeapTag tag, BitmapLayer** bitmap_layer, Window* window );
+void common_destroy_h_icon( HeapTag tag, BitmapLayer* bitmap_layer );
 
-void common_create_h_icon( BitmapLayer** bitmap_layer, Window* window );
 
+uint32_t common_time_ms();
 
 void common_set_current_bus_stop_id( int id );
 int common_get_current_bus_stop_id();
@@ -32,4 +112,13 @@ int common_get_current_bus_stop_id();
 const char* common_find_next_separator( const char* cursor, const char separator );
 const char* common_read_csv_item( const char* csv_data, char* target, int max_bytes );
 
+void common_csv_tokenize( CsvTokens* tokens, const char* csv_data, int length, CsvSpan* spans, int max_spans );
+void common_csv_tokenize_in_place( CsvTokens* tokens, char* csv_data, int length, CsvSpan* spans, int max_spans );
+int common_csv_get_int( const CsvTokens* tokens, int index, int fallback );
+int common_csv_copy( const CsvTokens* tokens, int index, char* target, int max_bytes );
+const char* common_csv_get_string( const CsvTokens* tokens, int index );
+
+void common_persist_write_string( uint32_t first_key, int num_keys, const char* string );
+int common_persist_read_string( uint32_t first_key, int num_keys, char* target, int max_bytes );
+
 const char* common_app_message_result_to_string( AppMessageResult result );
@@ -0,0 +1,201 @@
+#include "latency.h"
+
+//==================================================================================================
+//==================================================================================================
+// Definitions
+
+// LATENCY_RING_SIZE is defined per platform in layout.h
+
+// Durations that are derived from the stage time stamps and the phone-side timings
+typedef enum {
+    LATENCY_METRIC_GPS = 0,
+    LATENCY_METRIC_HTTP,
+    LATENCY_METRIC_PHONE,
+    LATENCY_METRIC_RADIO,
+    LATENCY_METRIC_PARSE,
+    LATENCY_METRIC_DRAW,
+    LATENCY_METRIC_TOTAL,
+    LATENCY_NUM_METRICS
+} LatencyMetric;
+
+
+//==================================================================================================
+//==================================================================================================
+// Variables
+
+static const char* s_metric_names[ LATENCY_NUM_METRICS ] = {
+    "gps", "http", "phone", "radio", "parse", "draw", "total"
+};
+
+// time stamps of the update cycle that is currently in progress
+static uint32_t s_stamps[ LATENCY_NUM_STAGES ];
+static int s_marked_stages = 0;
+
+// phone-side timings of the current cycle as reported by the phone: gps, stop list http,
+// predictions http and total time between request arrival and reply
+static int s_phone_timings[ 4 ];
+
+static uint16_t s_samples[ LATENCY_RING_SIZE ][ LATENCY_NUM_METRICS ];
+static int s_next_sample = 0;
+static int s_num_samples = 0;
+
+
+//==================================================================================================
+//==================================================================================================
+// Helper functions
+
+uint16_t clamp_duration( int32_t duration )
+{
+    if( duration < 0 )
+    {
+        return 0;
+    }
+
+    return ( uint16_t ) min( duration, UINT16_MAX );
+}
+
+uint32_t stage_delta( LatencyStage from, LatencyStage to )
+{
+    return s_stamps[ to ] - s_stamps[ from ];
+}
+
+/**
+ * Sorts the given metric of all recorded samples into target and returns the number of values.
+ */
+int sorted_metric_values( LatencyMetric metric, uint16_t* target )
+{
+    for( int i = 0; i < s_num_samples; ++i )
+    {
+        uint16_t value = s_samples[ i ][ metric ];
+        int j = i;
+
+        // insertion sort is perfectly fine for a handful of samples
+        while( j > 0 && target[ j - 1 ] > value )
+        {
+            target[ j ] = target[ j - 1 ];
+            --j;
+        }
+        target[ j ] = value;
+    }
+
+    return s_num_samples;
+}
+
+void metric_percentiles( LatencyMetric metric, int* p50, int* p95 )
+{
+    uint16_t values[ LATENCY_RING_SIZE ];
+    int num_values = sorted_metric_values( metric, values );
+
+    if( num_values == 0 )
+    {
+        *p50 = 0;
+        *p95 = 0;
+        return;
+    }
+
+    *p50 = values[ ( ( num_values - 1 ) * 50 ) / 100 ];
+    *p95 = values[ ( ( num_values - 1 ) * 95 ) / 100 ];
+}
+
+
+//==================================================================================================
+//==================================================================================================
+// Interface functions
+
+void latency_mark( LatencyStage stage )
+{
+    if( stage == LATENCY_STAGE_REQUEST_SENT )
+    {
+        // a new request starts a new cycle
+        s_marked_stages = 0;
+        memset( s_phone_timings, 0, sizeof( s_phone_timings ) );
+    }
+
+    s_stamps[ stage ] = common_time_ms();
+    s_marked_stages |= ( 1 << stage );
+}
+
+void latency_set_phone_timings( const char* phone_timings )
+{
+    char item[ 8 ];
+
+    for( int i = 0; i != 4; ++i )
+    {
+        phone_timings = common_read_csv_item( phone_timings, item, sizeof( item ) );
+        s_phone_timings[ i ] = atoi( item );
+    }
+}
+
+void latency_commit()
+{
+    const int all_stages = ( 1 << LATENCY_NUM_STAGES ) - 1;
+
+    // only complete cycles make meaningful samples, e.g. replies to requests of a previous
+    // app session are ignored
+    if( s_marked_stages != all_stages )
+    {
+        return;
+    }
+
+    uint16_t* sample = s_samples[ s_next_sample ];
+    uint32_t round_trip = stage_delta( LATENCY_STAGE_REQUEST_SENT, LATENCY_STAGE_INBOX_RECEIVED );
+
+    sample[ LATENCY_METRIC_GPS ]   = clamp_duration( s_phone_timings[ 0 ] );
+    sample[ LATENCY_METRIC_HTTP ]  = clamp_duration( s_phone_timings[ 1 ] + s_phone_timings[ 2 ] );
+    sample[ LATENCY_METRIC_PHONE ] = clamp_duration( s_phone_timings[ 3 ] );
+    sample[ LATENCY_METRIC_RADIO ] = clamp_duration( ( int32_t ) round_trip - s_phone_timings[ 3 ] );
+    sample[ LATENCY_METRIC_PARSE ] = clamp_duration( stage_delta( LATENCY_STAGE_INBOX_RECEIVED,
+                                                                  LATENCY_STAGE_PARSE_DONE ) );
+    sample[ LATENCY_METRIC_DRAW ]  = clamp_duration( stage_delta( LATENCY_STAGE_PARSE_DONE,
+                                                                  LATENCY_STAGE_LAYERS_UPDATED ) );
+    sample[ LATENCY_METRIC_TOTAL ] = clamp_duration( stage_delta( LATENCY_STAGE_REQUEST_SENT,
+                                                                  LATENCY_STAGE_LAYERS_UPDATED ) );
+
+    s_next_sample = ( s_next_sample + 1 ) % LATENCY_RING_SIZE;
+    s_num_samples = min( s_num_samples + 1, LATENCY_RING_SIZE );
+    s_marked_stages = 0;
+
+    APP_LOG( APP_LOG_LEVEL_DEBUG, "[ACbus] Update took %d ms (phone %d ms).",
+             sample[ LATENCY_METRIC_TOTAL ], sample[ LATENCY_METRIC_PHONE ] );
+}
+
+
+void latency_format_summary( char* target, int max_bytes )
+{
+    int written = snprintf( target, max_bytes, "%d samples, p50/p95 ms\n", s_num_samples );
+
+    for( int i = 0; i != LATENCY_NUM_METRICS && written < max_bytes; ++i )
+    {
+        int p50 = 0;
+        int p95 = 0;
+        metric_percentiles( ( LatencyMetric ) i, &p50, &p95 );
+
+        written += snprintf( target + written, max_bytes - written, "%s: %d / %d\n",
+                             s_metric_names[ i ], p50, p95 );
+    }
+}
+
+void latency_dump_to_log()
+{
+    APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] Latency summary over %d samples (p50 / p95 ms):",
+             s_num_samples );
+
+    for( int i = 0; i != LATENCY_NUM_METRICS; ++i )
+    {
+        int p50 = 0;
+        int p95 = 0;
+        metric_percentiles( ( LatencyMetric ) i, &p50, &p95 );
+
+        APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus]   %s: %d / %d", s_metric_names[ i ], p50, p95 );
+    }
+
+    // oldest sample first
+    for( int i = 0; i != s_num_samples; ++i )
+    {
+        int idx = ( s_next_sample - s_num_samples + i + LATENCY_RING_SIZE ) % LATENCY_RING_SIZE;
+        const uint16_t* sample = s_samples[ idx ];
+
+        APP_LOG( APP_LOG_LEVEL_DEBUG, "[ACbus]   #%d gps %d http %d phone %d radio %d parse %d draw %d total %d",
+                 i, sample[ 0 ], sample[ 1 ], sample[ 2 ], sample[ 3 ], sample[ 4 ], sample[ 5 ], sample[ 6 ] );
+    }
+}
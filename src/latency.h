@@ -0,0 +1,19 @@
+#pragma once
+
+#include "common.h"
+
+// Points in time of a single update cycle, in the order they are passed
+typedef enum {
+    LATENCY_STAGE_REQUEST_SENT = 0,
+    LATENCY_STAGE_INBOX_RECEIVED,
+    LATENCY_STAGE_PARSE_DONE,
+    LATENCY_STAGE_LAYERS_UPDATED,
+    LATENCY_NUM_STAGES
+} LatencyStage;
+
+void latency_mark( LatencyStage stage );
+void latency_set_phone_timings( const char* phone_timings );
+void latency_commit();
+
+void latency_format_summary( char* target, int max_bytes );
+void latency_dump_to_log();
@@ -0,0 +1,137 @@
+#pragma once
+
+// Per-platform layout and capacity table. The SDK builds the app once for every entry in
+// targetPlatforms and defines PBL_PLATFORM_<NAME> for each build, so exactly one of the blocks
+// below is compiled into every binary and all windows share one rendering path without any
+// geometry decisions at runtime.
+//
+// SCREEN_*              screen size
+// HEADER_HEIGHT         height of the colored band that holds the H icon and the title
+// TITLE_RECT            window title next to the H icon
+// ICON_RECT             H icon
+// STATUS_RECT           status bar at the bottom
+// ROW_TOP               y of the first list row
+// ROW_LEFT, ROW_WIDTH   horizontal extent of list rows with a small margin
+// ROW_HEIGHT            height of a list row
+// NUM_ROWS              list rows that fit between header and status bar
+// BUS_ENTRY_*           horizontal layout of a bus entry on the board
+// NUM_BUSES             bus entries kept and requested from the phone
+// LATENCY_RING_SIZE     update cycles kept for the latency percentiles
+// INBOX_*_SIZE          back buffers for received app messages
+// APP_MESSAGE_*_SIZE    AppMessage buffers
+
+#if defined( PBL_PLATFORM_APLITE )
+
+// Same screen as basalt, but only 24k of app heap: fewer cached rows and smaller buffers. Not in
+// targetPlatforms until code size and free heap after init were measured on aplite.
+#define SCREEN_WIDTH              144
+#define SCREEN_HEIGHT             168
+#define HEADER_HEIGHT              25
+#define TITLE_RECT                GRect( 24, 0, 120, 20 )
+#define ICON_RECT                 GRect( 3, 3, 18, 18 )
+#define STATUS_RECT               GRect( 0, 148, 144, 20 )
+#define ROW_TOP                    28
+#define ROW_LEFT                    3
+#define ROW_WIDTH                 138
+#define ROW_HEIGHT                 16
+#define NUM_ROWS                    7
+#define BUS_ENTRY_LEFT              0
+#define BUS_ENTRY_MARGIN_LEFT       3
+#define BUS_ENTRY_LINE_WIDTH       28
+#define BUS_ENTRY_DEST_WIDTH       92
+#define BUS_ENTRY_ETA_WIDTH        18
+#define NUM_BUSES                  14
+#define LATENCY_RING_SIZE           8
+#define INBOX_BUS_STOP_DATA_SIZE  384
+#define INBOX_BUS_DATA_SIZE       640
+#define APP_MESSAGE_INBOX_SIZE   1024
+#define APP_MESSAGE_OUTBOX_SIZE   128
+
+#elif defined( PBL_PLATFORM_CHALK )
+
+// Round 180x180 screen: everything stays inside the visible circle. Icon and title are centered
+// in the chord x 45..135 at the top of the header (y 12). Rows are cut to the chord x 21..159 at
+// the bottom of the last row (y 36 + 7 * 16 = 148), which is narrower than the one at the top.
+#define SCREEN_WIDTH              180
+#define SCREEN_HEIGHT             180
+#define HEADER_HEIGHT              32
+#define TITLE_RECT                GRect( 68, 12, 66, 20 )
+#define ICON_RECT                 GRect( 46, 13, 18, 18 )
+#define STATUS_RECT               GRect( 0, 152, 180, 28 )
+#define ROW_TOP                    36
+#define ROW_LEFT                   22
+#define ROW_WIDTH                 136
+#define ROW_HEIGHT                 16
+#define NUM_ROWS                    7
+#define BUS_ENTRY_LEFT             22
+#define BUS_ENTRY_MARGIN_LEFT       3
+#define BUS_ENTRY_LINE_WIDTH       26
+#define BUS_ENTRY_DEST_WIDTH       83
+#define BUS_ENTRY_ETA_WIDTH        22
+#define NUM_BUSES                  21
+#define LATENCY_RING_SIZE          16
+#define INBOX_BUS_STOP_DATA_SIZE  512
+#define INBOX_BUS_DATA_SIZE      1024
+#define APP_MESSAGE_INBOX_SIZE    app_message_inbox_size_maximum()
+#define APP_MESSAGE_OUTBOX_SIZE   app_message_outbox_size_maximum()
+
+#elif defined( PBL_PLATFORM_EMERY )
+
+// 200x228 screen: wider destinations and more rows per page
+#define SCREEN_WIDTH              200
+#define SCREEN_HEIGHT             228
+#define HEADER_HEIGHT              25
+#define TITLE_RECT                GRect( 24, 0, 176, 20 )
+#define ICON_RECT                 GRect( 3, 3, 18, 18 )
+#define STATUS_RECT               GRect( 0, 208, 200, 20 )
+#define ROW_TOP                    28
+#define ROW_LEFT                    3
+#define ROW_WIDTH                 194
+#define ROW_HEIGHT                 16
+#define NUM_ROWS                   11
+#define BUS_ENTRY_LEFT              0
+#define BUS_ENTRY_MARGIN_LEFT       3
+#define BUS_ENTRY_LINE_WIDTH       32
+#define BUS_ENTRY_DEST_WIDTH      139
+#define BUS_ENTRY_ETA_WIDTH        24
+#define NUM_BUSES                  22
+#define LATENCY_RING_SIZE          16
+#define INBOX_BUS_STOP_DATA_SIZE  512
+#define INBOX_BUS_DATA_SIZE      1024
+#define APP_MESSAGE_INBOX_SIZE    app_message_inbox_size_maximum()
+#define APP_MESSAGE_OUTBOX_SIZE   app_message_outbox_size_maximum()
+
+#else
+
+// basalt and diorite
+#define SCREEN_WIDTH              144
+#define SCREEN_HEIGHT             168
+#define HEADER_HEIGHT              25
+#define TITLE_RECT                GRect( 24, 0, 120, 20 )
+#define ICON_RECT                 GRect( 3, 3, 18, 18 )
+#define STATUS_RECT               GRect( 0, 148, 144, 20 )
+#define ROW_TOP                    28
+#define ROW_LEFT                    3
+#define ROW_WIDTH                 138
+#define ROW_HEIGHT                 16
+#define NUM_ROWS                    7
+#define BUS_ENTRY_LEFT              0
+#define BUS_ENTRY_MARGIN_LEFT       3
+#define BUS_ENTRY_LINE_WIDTH       28
+#define BUS_ENTRY_DEST_WIDTH       92
+#define BUS_ENTRY_ETA_WIDTH        18
+#define NUM_BUSES                  21
+#define LATENCY_RING_SIZE          16
+#define INBOX_BUS_STOP_DATA_SIZE  512
+#define INBOX_BUS_DATA_SIZE      1024
+#define APP_MESSAGE_INBOX_SIZE    app_message_inbox_size_maximum()
+#define APP_MESSAGE_OUTBOX_SIZE   app_message_outbox_size_maximum()
+
+#endif
+
+// Derived layout
+#define CONTENT_RECT              GRect( 0, HEADER_HEIGHT, SCREEN_WIDTH, STATUS_RECT.origin.y - HEADER_HEIGHT )
+#define CONTENT_TEXT_RECT         GRect( ROW_LEFT, ROW_TOP, ROW_WIDTH, SCREEN_HEIGHT - ROW_TOP )
+
+// The accent color of header and status bar, black on black and white displays
+#define COLOR_ACCENT              PBL_IF_COLOR_ELSE( GColorDarkCandyAppleRed, GColorBlack )
@@ -0,0 +1,452 @@
+#include "line_filter.h"
+#include "bus_display.h"
+
+//==================================================================================================
+//==================================================================================================
+// Definitions
+
+#define LINE_FILTER_NUM_STOPS       4
+#define LINE_FILTER_MAX_LINES       8
+#define LINE_FILTER_MAX_SEEN       32  // distinct lines selectable per bus stop, enough for Bushof
+#define LINE_NAME_SIZE              6
+
+#define NUM_LINE_FILTER_ROWS       NUM_ROWS
+
+#define LINE_FILTER_MARK_WIDTH     20
+#define LINE_FILTER_NAME_WIDTH     ( ROW_WIDTH - LINE_FILTER_MARK_WIDTH )
+
+#define LINE_FILTER_REQUEST_SIZE  ( 12 + LINE_FILTER_MAX_LINES * LINE_NAME_SIZE )
+
+
+//==================================================================================================
+//==================================================================================================
+// Variables
+
+// The lines a rider wants to see at a bus stop. An entry without lines is unused.
+typedef struct {
+    int32_t bus_stop_id;
+    int32_t num_lines;
+    char lines[ LINE_FILTER_MAX_LINES ][ LINE_NAME_SIZE ];
+} LineFilter;
+
+static LineFilter s_line_filters[ LINE_FILTER_NUM_STOPS ];
+
+// bumped whenever a filter changes, so requests with an outdated filter can be told apart
+static int s_revision = 0;
+
+// the bus stop currently shown on the board and the lines that were seen there so far
+static int s_displayed_bus_stop_id = -1;
+static char s_seen_lines[ LINE_FILTER_MAX_SEEN ][ LINE_NAME_SIZE ];
+static int s_num_seen_lines = 0;
+
+// the window and its layers only exist while the window is on the window stack
+static Window* s_line_filter_wnd = NULL;
+static TextLayer* s_line_filter_title = NULL;
+static BitmapLayer* s_line_filter_banner = NULL;
+
+static struct {
+    TextLayer* name;
+    TextLayer* mark;
+} s_line_filter_rows[ NUM_LINE_FILTER_ROWS ];
+
+// row 0 is "All lines", row i > 0 is seen line i - 1
+static int s_selected_row = 0;
+static int s_revision_at_show = 0;
+
+
+//==================================================================================================
+//==================================================================================================
+// Filter handling
+
+LineFilter* find_line_filter( int bus_stop_id )
+{
+    for( int i = 0; i != LINE_FILTER_NUM_STOPS; ++i )
+    {
+        if( s_line_filters[ i ].num_lines > 0 && s_line_filters[ i ].bus_stop_id == bus_stop_id )
+        {
+            return &s_line_filters[ i ];
+        }
+    }
+    return NULL;
+}
+
+LineFilter* create_line_filter( int bus_stop_id )
+{
+    for( int i = 0; i != LINE_FILTER_NUM_STOPS; ++i )
+    {
+        if( s_line_filters[ i ].num_lines == 0 )
+        {
+            s_line_filters[ i ].bus_stop_id = bus_stop_id;
+            return &s_line_filters[ i ];
+        }
+    }
+    
+    // all entries are in use, drop the oldest one
+    memmove( &s_line_filters[ 0 ], &s_line_filters[ 1 ], ( LINE_FILTER_NUM_STOPS - 1 ) * sizeof( LineFilter ) );
+    
+    LineFilter* filter = &s_line_filters[ LINE_FILTER_NUM_STOPS - 1 ];
+    filter->bus_stop_id = bus_stop_id;
+    filter->num_lines = 0;
+    return filter;
+}
+
+int find_line( const LineFilter* filter, const char* line )
+{
+    for( int i = 0; filter != NULL && i != filter->num_lines; ++i )
+    {
+        if( strcmp( filter->lines[ i ], line ) == 0 )
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void toggle_line( int bus_stop_id, const char* line )
+{
+    LineFilter* filter = find_line_filter( bus_stop_id );
+    const int idx = find_line( filter, line );
+    
+    if( idx != -1 )
+    {
+        // an entry that loses its last line becomes unused
+        --filter->num_lines;
+        memmove( filter->lines[ idx ], filter->lines[ idx + 1 ], ( filter->num_lines - idx ) * LINE_NAME_SIZE );
+    }
+    else
+    {
+        if( filter == NULL )
+        {
+            filter = create_line_filter( bus_stop_id );
+        }
+        
+        if( filter->num_lines < LINE_FILTER_MAX_LINES )
+        {
+            snprintf( filter->lines[ filter->num_lines ], LINE_NAME_SIZE, "%s", line );
+            ++filter->num_lines;
+        }
+    }
+    
+    ++s_revision;
+}
+
+void clear_line_filter( int bus_stop_id )
+{
+    LineFilter* filter = find_line_filter( bus_stop_id );
+    
+    if( filter != NULL )
+    {
+        filter->num_lines = 0;
+        ++s_revision;
+    }
+}
+
+void add_seen_line( const char* line )
+{
+    if( *line == '\0' )
+    {
+        return;
+    }
+    
+    for( int i = 0; i != s_num_seen_lines; ++i )
+    {
+        // seen lines are truncated to LINE_NAME_SIZE - 1 chars, so are the lines compared to them
+        if( strncmp( s_seen_lines[ i ], line, LINE_NAME_SIZE - 1 ) == 0 )
+        {
+            return;
+        }
+    }
+    
+    if( s_num_seen_lines == LINE_FILTER_MAX_SEEN )
+    {
+        APP_LOG( APP_LOG_LEVEL_WARNING, "[ACbus] Line %s is not selectable, %d lines seen already.",
+                 line, LINE_FILTER_MAX_SEEN );
+        return;
+    }
+    
+    snprintf( s_seen_lines[ s_num_seen_lines ], LINE_NAME_SIZE, "%s", line );
+    ++s_num_seen_lines;
+}
+
+void parse_displayed_bus_stop( const char* bus_stop_data, int length )
+{
+    // the first entry (name;distance;id) is the bus stop the board shows
+    CsvSpan spans[ 3 ];
+    CsvTokens tokens;
+    common_csv_tokenize( &tokens, bus_stop_data, length, spans, 3 );
+    
+    const int bus_stop_id = common_csv_get_int( &tokens, 2, -1 );
+    
+    if( bus_stop_id != s_displayed_bus_stop_id )
+    {
+        s_displayed_bus_stop_id = bus_stop_id;
+        s_num_seen_lines = 0;
+        
+        // wanted lines stay selectable, even if the filter hides all others from now on
+        const LineFilter* filter = find_line_filter( bus_stop_id );
+        
+        for( int i = 0; filter != NULL && i != filter->num_lines; ++i )
+        {
+            add_seen_line( filter->lines[ i ] );
+        }
+    }
+}
+
+/**
+ * Takes the lines from the fields the board has terminated in the BUS_DATA payload already, so
+ * the payload is neither scanned nor copied a second time.
+ */
+void parse_seen_lines( const CsvTokens* bus_data_tokens )
+{
+    // a local copy, so the tokens are not read again for every line
+    const CsvTokens tokens = *bus_data_tokens;
+    
+    // skip the number of buses, then every entry is line;destination;eta
+    for( int i = 1; i < tokens.num_spans; i += 3 )
+    {
+        add_seen_line( common_csv_get_string( &tokens, i ) );
+    }
+}
+
+
+//==================================================================================================
+//==================================================================================================
+// Window helper functions
+
+GRect line_filter_name_rect( int index )
+{
+    return GRect( ROW_LEFT,
+                  ROW_TOP + index * ROW_HEIGHT,
+                  LINE_FILTER_NAME_WIDTH,
+                  ROW_HEIGHT );
+}
+
+GRect line_filter_mark_rect( int index )
+{
+    return GRect( ROW_LEFT + LINE_FILTER_NAME_WIDTH,
+                  ROW_TOP + index * ROW_HEIGHT,
+                  LINE_FILTER_MARK_WIDTH,
+                  ROW_HEIGHT );
+}
+
+void update_line_filter_rows()
+{
+    const LineFilter* filter = find_line_filter( s_displayed_bus_stop_id );
+    
+    // scroll, so that the selected row is always visible
+    const int first_row = max( 0, s_selected_row - ( NUM_LINE_FILTER_ROWS - 1 ) );
+    
+    for( int i = 0; i != NUM_LINE_FILTER_ROWS; ++i )
+    {
+        const int row = first_row + i;
+        const char* name = "";
+        bool checked = false;
+        
+        if( row == 0 )
+        {
+            name = "All lines";
+            checked = ( filter == NULL );
+        }
+        else if( row <= s_num_seen_lines )
+        {
+            name = s_seen_lines[ row - 1 ];
+            checked = ( find_line( filter, name ) != -1 );
+        }
+        
+        const bool selected = ( row == s_selected_row );
+        
+        text_layer_set_text( s_line_filter_rows[ i ].name, name );
+        text_layer_set_text( s_line_filter_rows[ i ].mark, checked ? "x" : "" );
+        
+        text_layer_set_background_color( s_line_filter_rows[ i ].name, selected ? COLOR_ACCENT : GColorWhite );
+        text_layer_set_background_color( s_line_filter_rows[ i ].mark, selected ? COLOR_ACCENT : GColorWhite );
+        text_layer_set_text_color( s_line_filter_rows[ i ].name, selected ? GColorWhite : GColorBlack );
+        text_layer_set_text_color( s_line_filter_rows[ i ].mark, selected ? GColorWhite : GColorBlack );
+    }
+}
+
+
+//==================================================================================================
+//==================================================================================================
+// Button click handling
+
+void line_filter_previous_row( ClickRecognizerRef recognizer, void* context )
+{
+    if( s_selected_row > 0 )
+    {
+        --s_selected_row;
+        update_line_filter_rows();
+    }
+}
+
+void line_filter_next_row( ClickRecognizerRef recognizer, void* context )
+{
+    if( s_selected_row < s_num_seen_lines )
+    {
+        ++s_selected_row;
+        update_line_filter_rows();
+    }
+}
+
+void line_filter_toggle_row( ClickRecognizerRef recognizer, void* context )
+{
+    if( s_selected_row == 0 )
+    {
+        clear_line_filter( s_displayed_bus_stop_id );
+    }
+    else
+    {
+        toggle_line( s_displayed_bus_stop_id, s_seen_lines[ s_selected_row - 1 ] );
+    }
+    
+    update_line_filter_rows();
+}
+
+void line_filter_click_provider( Window* window )
+{
+    window_single_click_subscribe( BUTTON_ID_SELECT, line_filter_toggle_row );
+    
+    window_single_click_subscribe( BUTTON_ID_UP, line_filter_previous_row );
+    window_single_click_subscribe( BUTTON_ID_DOWN, line_filter_next_row );
+}
+
+
+//==================================================================================================
+//==================================================================================================
+// Window (un)loading
+
+void line_filter_window_load()
+{
+    common_create_text_layer( HEAP_TAG_SELECTION, &s_line_filter_title, s_line_filter_wnd, TITLE_RECT,
+                              COLOR_ACCENT, GColorWhite, FONT_KEY_GOTHIC_18_BOLD,
+                              GTextAlignmentLeft );
+    text_layer_set_text( s_line_filter_title, "Select lines" );
+    
+    common_create_h_icon( HEAP_TAG_SELECTION, &s_line_filter_banner, s_line_filter_wnd );
+    
+    for( int i = 0; i != NUM_LINE_FILTER_ROWS; ++i )
+    {
+        common_create_text_layer( HEAP_TAG_SELECTION, &s_line_filter_rows[ i ].name, s_line_filter_wnd,
+                                  line_filter_name_rect( i ), GColorWhite, GColorBlack,
+                                  FONT_KEY_GOTHIC_14_BOLD, GTextAlignmentLeft );
+        common_create_text_layer( HEAP_TAG_SELECTION, &s_line_filter_rows[ i ].mark, s_line_filter_wnd,
+                                  line_filter_mark_rect( i ), GColorWhite, GColorBlack,
+                                  FONT_KEY_GOTHIC_14_BOLD, GTextAlignmentCenter );
+    }
+    
+    s_selected_row = 0;
+    s_revision_at_show = s_revision;
+    update_line_filter_rows();
+}
+
+void line_filter_window_unload()
+{
+    for( int i = 0; i != NUM_LINE_FILTER_ROWS; ++i )
+    {
+        common_destroy_text_layer( HEAP_TAG_SELECTION, s_line_filter_rows[ i ].name );
+        common_destroy_text_layer( HEAP_TAG_SELECTION, s_line_filter_rows[ i ].mark );
+    }
+    common_destroy_h_icon( HEAP_TAG_SELECTION, s_line_filter_banner );
+    common_destroy_text_layer( HEAP_TAG_SELECTION, s_line_filter_title );
+    
+    common_window_destroy( HEAP_TAG_SELECTION, s_line_filter_wnd );
+    s_line_filter_wnd = NULL;
+    
+    if( s_revision != s_revision_at_show )
+    {
+        persist_write_data( PERSIST_KEY_LINE_FILTERS, s_line_filters, sizeof( s_line_filters ) );
+        
+        // the board shows lines the user does not want any more, or lacks wanted ones
+        common_get_update_callback()( REQUEST_PRIORITY_USER );
+    }
+}
+
+
+//==================================================================================================
+//==================================================================================================
+// Interface functions
+
+void line_filter_load()
+{
+    memset( s_line_filters, 0, sizeof( s_line_filters ) );
+    
+    if( persist_exists( PERSIST_KEY_LINE_FILTERS ) )
+    {
+        persist_read_data( PERSIST_KEY_LINE_FILTERS, s_line_filters, sizeof( s_line_filters ) );
+    }
+}
+
+
+void line_filter_handle_msg( uint32_t key, const char* data, int length )
+{
+    switch( key )
+    {
+        case BUS_STOP_DATA:
+        {
+            parse_displayed_bus_stop( data, length );
+        }
+        break;
+        case BUS_DATA:
+        {
+            // the board handles the message first, see handle_msg_data
+            parse_seen_lines( bus_display_get_bus_data_tokens() );
+        }
+        break;
+        default:
+        // intentionally left blank
+        break;
+    }
+}
+
+/**
+ * Adds the filter of the requested bus stop to the request, as "bus stop id;line;line;...". If
+ * the closest bus stop is requested, the filter of the bus stop on the board is sent and the
+ * phone only applies it if it picks the same bus stop again.
+ */
+void line_filter_write_request( DictionaryIterator* iter )
+{
+    const int bus_stop_id = common_get_current_bus_stop_id() != -1 ? common_get_current_bus_stop_id()
+                                                                    : s_displayed_bus_stop_id;
+    const LineFilter* filter = find_line_filter( bus_stop_id );
+    
+    if( filter == NULL )
+    {
+        return;
+    }
+    
+    char request[ LINE_FILTER_REQUEST_SIZE ];
+    int written = snprintf( request, sizeof( request ), "%d", bus_stop_id );
+    
+    for( int i = 0; i != filter->num_lines && written < ( int ) sizeof( request ); ++i )
+    {
+        written += snprintf( request + written, sizeof( request ) - written, ";%s", filter->lines[ i ] );
+    }
+    
+    dict_write_cstring( iter, REQ_LINE_FILTER, request );
+}
+
+int line_filter_get_revision()
+{
+    return s_revision;
+}
+
+
+void line_filter_show()
+{
+    // lines can only be chosen once the board shows a bus stop
+    if( s_line_filter_wnd == NULL && s_displayed_bus_stop_id != -1 )
+    {
+        s_line_filter_wnd = common_window_create( HEAP_TAG_SELECTION );
+        
+        window_set_window_handlers( s_line_filter_wnd, ( WindowHandlers )
+        {
+            .load = line_filter_window_load,
+            .unload = line_filter_window_unload
+        } );
+        
+        window_set_click_config_provider( s_line_filter_wnd,
+                                          ( ClickConfigProvider ) line_filter_click_provider );
+        
+        window_stack_push( s_line_filter_wnd, true );
+    }
+}
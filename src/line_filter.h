@@ -0,0 +1,11 @@
+#pragma once
+
+#include "common.h"
+
+void line_filter_load();
+
+void line_filter_handle_msg( uint32_t key, const char* data, int length );
+void line_filter_write_request( DictionaryIterator* iter );
+int line_filter_get_revision();
+
+void line_filter_show();
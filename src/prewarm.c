@@ -0,0 +1,392 @@
+#include "prewarm.h"
+
+//==================================================================================================
+//==================================================================================================
+// Definitions
+
+#define PREWARM_MAX_SLOTS              3
+#define PREWARM_LEAD_IN_MINS           5
+#define PREWARM_MAX_RUNS_PER_DAY       4
+#define PREWARM_TIMEOUT_IN_MS      45000
+#define PREWARM_MAX_AGE_IN_SECS      900
+
+#define PREWARM_STOP_DATA_KEYS         2
+#define PREWARM_BUS_DATA_KEYS          4
+
+// the number of buses, then line;destination;eta of every bus
+#define PREWARM_BUS_DATA_SPANS      ( 1 + 3 * NUM_BUSES )
+
+
+//==================================================================================================
+//==================================================================================================
+// Variables
+
+// A commute slot is a time of day on weekdays at which the rider usually checks a bus stop
+typedef struct {
+    int32_t minute_of_day;
+    int32_t bus_stop_id;
+} PrewarmSlot;
+
+typedef struct {
+    int32_t num_slots;
+    PrewarmSlot slots[ PREWARM_MAX_SLOTS ];
+} PrewarmSlots;
+
+typedef struct {
+    int32_t day;
+    int32_t num_runs;
+} PrewarmBudget;
+
+typedef struct {
+    int32_t timestamp;
+    int32_t bus_stop_id;
+} PrewarmMeta;
+
+static PrewarmSlots s_prewarm_slots;
+static bool s_prewarm_running = false;
+static AppTimer* s_prewarm_timeout = NULL;
+
+
+//==================================================================================================
+//==================================================================================================
+// Helper functions
+
+void save_prewarm_slots()
+{
+    persist_write_data( PERSIST_KEY_PREWARM_SLOTS, &s_prewarm_slots, sizeof( s_prewarm_slots ) );
+}
+
+/**
+ * The ETAs of stored BUS_DATA are minutes from the time it was fetched. Shortens them by the
+ * minutes that passed since, drops the buses that left already and returns the new length. The
+ * fields only ever move towards the front, so this is done in place.
+ */
+int age_bus_data( char* bus_data, int length, int age_in_mins )
+{
+    CsvSpan spans[ PREWARM_BUS_DATA_SPANS ];
+    CsvTokens tokens;
+    common_csv_tokenize( &tokens, bus_data, length, spans, PREWARM_BUS_DATA_SPANS );
+    
+    const int num_buses = ( tokens.num_spans - 1 ) / 3;
+    
+    if( age_in_mins <= 0 || num_buses <= 0 )
+    {
+        return length;
+    }
+    
+    int num_left = 0;
+    
+    for( int i = 0; i < num_buses; ++i )
+    {
+        if( common_csv_get_int( &tokens, 3 + i * 3, 0 ) >= age_in_mins )
+        {
+            ++num_left;
+        }
+    }
+    
+    // the count and the etas never get longer than they were
+    char number[ 12 ];
+    int num_bytes = snprintf( number, sizeof( number ), "%d;", num_left );
+    memcpy( bus_data, number, num_bytes );
+    
+    for( int i = 0; i < num_buses; ++i )
+    {
+        const int eta = common_csv_get_int( &tokens, 3 + i * 3, 0 ) - age_in_mins;
+        
+        if( eta < 0 )
+        {
+            continue;
+        }
+        
+        // the count already ends with a separator
+        if( bus_data[ num_bytes - 1 ] != ';' )
+        {
+            bus_data[ num_bytes++ ] = ';';
+        }
+        
+        // line;destination;
+        const CsvSpan line = spans[ 1 + i * 3 ];
+        const CsvSpan dest = spans[ 2 + i * 3 ];
+        memmove( bus_data + num_bytes, bus_data + line.offset, line.length );
+        num_bytes += line.length;
+        bus_data[ num_bytes++ ] = ';';
+        memmove( bus_data + num_bytes, bus_data + dest.offset, dest.length );
+        num_bytes += dest.length;
+        bus_data[ num_bytes++ ] = ';';
+        
+        const int eta_bytes = snprintf( number, sizeof( number ), "%d", eta );
+        memcpy( bus_data + num_bytes, number, eta_bytes );
+        num_bytes += eta_bytes;
+    }
+    
+    bus_data[ num_bytes ] = '\0';
+    return num_bytes;
+}
+
+/**
+ * Only the very next pre-warm run is scheduled. It is rescheduled on every launch and after
+ * every run, which keeps us well below the limit of wakeups an app may register.
+ */
+void schedule_next_wakeup()
+{
+    wakeup_cancel_all();
+    
+    time_t now = time( NULL );
+    time_t next_wakeup = 0;
+    int next_slot = -1;
+    
+    for( int i = 0; i != s_prewarm_slots.num_slots; ++i )
+    {
+        const PrewarmSlot* slot = &s_prewarm_slots.slots[ i ];
+        
+        for( WeekDay day = MONDAY; day <= FRIDAY; ++day )
+        {
+            time_t wakeup = clock_to_timestamp( day, slot->minute_of_day / 60, slot->minute_of_day % 60 )
+                            - PREWARM_LEAD_IN_MINS * SECONDS_PER_MINUTE;
+            
+            // the lead time might move today's run into the past
+            if( wakeup <= now + SECONDS_PER_MINUTE )
+            {
+                wakeup += 7 * SECONDS_PER_DAY;
+            }
+            
+            if( next_slot == -1 || wakeup < next_wakeup )
+            {
+                next_wakeup = wakeup;
+                next_slot = i;
+            }
+        }
+    }
+    
+    if( next_slot != -1 )
+    {
+        // do not launch the app if the watch was off at wakeup time, the data would be stale
+        WakeupId id = wakeup_schedule( next_wakeup, next_slot, false );
+        
+        if( id < 0 )
+        {
+            APP_LOG( APP_LOG_LEVEL_ERROR, "[ACbus] Scheduling pre-warm failed with %d.", ( int ) id );
+        }
+    }
+}
+
+bool consume_prewarm_budget()
+{
+    PrewarmBudget budget = { 0, 0 };
+    const int32_t today = time( NULL ) / SECONDS_PER_DAY;
+    
+    if( persist_exists( PERSIST_KEY_PREWARM_BUDGET ) )
+    {
+        persist_read_data( PERSIST_KEY_PREWARM_BUDGET, &budget, sizeof( budget ) );
+    }
+    
+    if( budget.day != today )
+    {
+        budget.day = today;
+        budget.num_runs = 0;
+    }
+    
+    if( budget.num_runs >= PREWARM_MAX_RUNS_PER_DAY )
+    {
+        return false;
+    }
+    
+    ++budget.num_runs;
+    persist_write_data( PERSIST_KEY_PREWARM_BUDGET, &budget, sizeof( budget ) );
+    return true;
+}
+
+void prewarm_timeout_handler( void* context )
+{
+    s_prewarm_timeout = NULL;
+    APP_LOG( APP_LOG_LEVEL_WARNING, "[ACbus] Pre-warm timed out." );
+    prewarm_finish();
+}
+
+void prewarm_wakeup_handler( WakeupId id, int32_t cookie )
+{
+    // the app is already open, so a regular refresh is all we need
+    schedule_next_wakeup();
+    common_get_update_callback()( REQUEST_PRIORITY_PERIODIC );
+}
+
+
+//==================================================================================================
+//==================================================================================================
+// Interface functions
+
+void prewarm_init()
+{
+    memset( &s_prewarm_slots, 0, sizeof( s_prewarm_slots ) );
+    
+    if( persist_exists( PERSIST_KEY_PREWARM_SLOTS ) )
+    {
+        persist_read_data( PERSIST_KEY_PREWARM_SLOTS, &s_prewarm_slots, sizeof( s_prewarm_slots ) );
+        s_prewarm_slots.num_slots = min( s_prewarm_slots.num_slots, PREWARM_MAX_SLOTS );
+    }
+    
+    wakeup_service_subscribe( prewarm_wakeup_handler );
+    schedule_next_wakeup();
+}
+
+
+/**
+ * Call on a launch by the wakeup service. Returns true if a pre-warm refresh should be run, in
+ * which case the current bus stop is set to the stop of the commute slot.
+ */
+bool prewarm_begin()
+{
+    WakeupId id = 0;
+    int32_t slot_idx = -1;
+    
+    if( !wakeup_get_launch_event( &id, &slot_idx ) ||
+        slot_idx < 0 || slot_idx >= s_prewarm_slots.num_slots )
+    {
+        return false;
+    }
+    
+    if( !connection_service_peek_pebble_app_connection() )
+    {
+        APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] Skipping pre-warm, phone is not connected." );
+        return false;
+    }
+    
+    if( !consume_prewarm_budget() )
+    {
+        APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] Skipping pre-warm, daily budget is used up." );
+        return false;
+    }
+    
+    common_set_current_bus_stop_id( s_prewarm_slots.slots[ slot_idx ].bus_stop_id );
+    s_prewarm_running = true;
+    s_prewarm_timeout = app_timer_register( PREWARM_TIMEOUT_IN_MS, prewarm_timeout_handler, NULL );
+    
+    return true;
+}
+
+bool prewarm_is_running()
+{
+    return s_prewarm_running;
+}
+
+void prewarm_store_result( const char* bus_stop_data, const char* bus_data )
+{
+    PrewarmMeta meta = { time( NULL ), common_get_current_bus_stop_id() };
+    
+    common_persist_write_string( PERSIST_KEY_PREWARM_STOP_DATA, PREWARM_STOP_DATA_KEYS, bus_stop_data );
+    common_persist_write_string( PERSIST_KEY_PREWARM_BUS_DATA, PREWARM_BUS_DATA_KEYS, bus_data );
+    persist_write_data( PERSIST_KEY_PREWARM_META, &meta, sizeof( meta ) );
+}
+
+void prewarm_finish()
+{
+    if( s_prewarm_timeout != NULL )
+    {
+        app_timer_cancel( s_prewarm_timeout );
+        s_prewarm_timeout = NULL;
+    }
+    
+    s_prewarm_running = false;
+    schedule_next_wakeup();
+    
+    // quit the app
+    window_stack_pop_all( false );
+}
+
+
+/**
+ * Adds a commute slot at the current time of day for the given bus stop. If there already is a
+ * slot close to the current time, that slot is removed instead. Returns true if a slot was added.
+ */
+bool prewarm_toggle_slot_now( int bus_stop_id )
+{
+    time_t now = time( NULL );
+    struct tm* local_now = localtime( &now );
+    const int minute_of_day = local_now->tm_hour * 60 + local_now->tm_min;
+    bool added = true;
+    
+    for( int i = 0; i != s_prewarm_slots.num_slots; ++i )
+    {
+        if( abs( s_prewarm_slots.slots[ i ].minute_of_day - minute_of_day ) <= PREWARM_LEAD_IN_MINS )
+        {
+            // remove it by moving the last slot into its place
+            s_prewarm_slots.slots[ i ] = s_prewarm_slots.slots[ s_prewarm_slots.num_slots - 1 ];
+            --s_prewarm_slots.num_slots;
+            added = false;
+            break;
+        }
+    }
+    
+    if( added )
+    {
+        if( s_prewarm_slots.num_slots == PREWARM_MAX_SLOTS )
+        {
+            // drop the oldest slot
+            memmove( &s_prewarm_slots.slots[ 0 ], &s_prewarm_slots.slots[ 1 ],
+                     ( PREWARM_MAX_SLOTS - 1 ) * sizeof( PrewarmSlot ) );
+            --s_prewarm_slots.num_slots;
+        }
+        
+        s_prewarm_slots.slots[ s_prewarm_slots.num_slots ].minute_of_day = minute_of_day;
+        s_prewarm_slots.slots[ s_prewarm_slots.num_slots ].bus_stop_id = bus_stop_id;
+        ++s_prewarm_slots.num_slots;
+    }
+    
+    APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] %s commute slot at %02d:%02d, %d slots registered.",
+             added ? "Added" : "Removed", minute_of_day / 60, minute_of_day % 60,
+             ( int ) s_prewarm_slots.num_slots );
+    
+    save_prewarm_slots();
+    schedule_next_wakeup();
+    
+    return added;
+}
+
+/**
+ * Feeds the result of the last pre-warm run to the handler, if it is recent enough. The current
+ * bus stop is set to the one of the pre-warm run, so the data is interpreted correctly.
+ */
+bool prewarm_replay_result( MessageDataHandler handler, int* age_in_secs )
+{
+    PrewarmMeta meta;
+    
+    if( !persist_exists( PERSIST_KEY_PREWARM_META ) )
+    {
+        return false;
+    }
+    
+    persist_read_data( PERSIST_KEY_PREWARM_META, &meta, sizeof( meta ) );
+    const int age = time( NULL ) - meta.timestamp;
+    
+    if( age < 0 || age > PREWARM_MAX_AGE_IN_SECS )
+    {
+        return false;
+    }
+    
+    // only needed during startup, so do not keep it around
+    const int buffer_size = PREWARM_BUS_DATA_KEYS * PERSIST_DATA_MAX_LENGTH;
+    char* buffer = common_malloc( HEAP_TAG_MESSAGING, buffer_size );
+    
+    if( buffer == NULL )
+    {
+        return false;
+    }
+    
+    // the stored data answers a request for the commute stop, so it has to be parsed as such, but
+    // the session itself keeps its mode, e.g. a GPS mode rider is not pinned to the commute stop
+    const int session_bus_stop_id = common_get_current_bus_stop_id();
+    common_set_current_bus_stop_id( meta.bus_stop_id );
+    
+    int length = common_persist_read_string( PERSIST_KEY_PREWARM_STOP_DATA, PREWARM_STOP_DATA_KEYS, buffer, buffer_size );
+    handler( BUS_STOP_DATA, buffer, length );
+    length = common_persist_read_string( PERSIST_KEY_PREWARM_BUS_DATA, PREWARM_BUS_DATA_KEYS, buffer, buffer_size );
+    length = age_bus_data( buffer, length, age / 60 );
+    handler( BUS_DATA, buffer, length );
+    
+    common_set_current_bus_stop_id( session_bus_stop_id );
+    
+    common_free( HEAP_TAG_MESSAGING, buffer );
+    
+    *age_in_secs = age;
+    return true;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "common.h"
+
+void prewarm_init();
+
+bool prewarm_begin();
+bool prewarm_is_running();
+void prewarm_store_result( const char* bus_stop_data, const char* bus_data );
+void prewarm_finish();
+
+bool prewarm_toggle_slot_now( int bus_stop_id );
+bool prewarm_replay_result( MessageDataHandler handler, int* age_in_secs );
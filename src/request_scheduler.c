@@ -0,0 +1,224 @@
+#include "request_scheduler.h"
+#include "latency.h"
+#include "stats.h"
+#include "line_filter.h"
+
+//==================================================================================================
+//==================================================================================================
+// Definitions
+
+#define TAP_DEBOUNCE_IN_MS          5000
+#define REQUEST_TIMEOUT_IN_SECS       60
+
+
+//==================================================================================================
+//==================================================================================================
+// Variables
+
+// Every request carries a generation id that the phone echoes in its reply. Generation 0 means
+// "no request".
+static uint32_t s_next_generation = 1;
+
+// Replies of generations below this one were superseded by a user request and are dropped
+static uint32_t s_min_accepted_generation = 0;
+
+static struct {
+    uint32_t generation;
+    int bus_stop_id;
+    int line_filter_revision;
+    int age_in_secs;
+} s_in_flight = { 0, -1, 0, 0 };
+
+// At most one request waits for the in-flight one or the outbox, later ones are merged into it
+static bool s_pending = false;
+static RequestPriority s_pending_priority = REQUEST_PRIORITY_PERIODIC;
+
+static bool s_outbox_busy = false;
+static uint32_t s_last_tap_ms = 0;
+
+
+//==================================================================================================
+//==================================================================================================
+// Helper functions
+
+void queue_request( RequestPriority priority )
+{
+    s_pending_priority = s_pending ? max( s_pending_priority, priority ) : priority;
+    s_pending = true;
+    
+    if( priority == REQUEST_PRIORITY_USER )
+    {
+        // the user changed the bus stop or line filter, so a reply to anything sent before is
+        // stale already while this request waits, it will be sent with the next generation
+        s_min_accepted_generation = s_next_generation;
+    }
+}
+
+void send_request( RequestPriority priority )
+{
+    DictionaryIterator* iter = NULL;
+    
+    if( s_outbox_busy || app_message_outbox_begin( &iter ) != APP_MSG_OK )
+    {
+        queue_request( priority );
+        return;
+    }
+    
+    const uint32_t generation = s_next_generation++;
+    
+    dict_write_uint32( iter, REQ_BUS_STOP_ID, common_get_current_bus_stop_id() );
+    dict_write_uint8( iter, REQ_UPDATE_BUS_STOP_LIST, 0 );
+    dict_write_uint32( iter, REQ_GENERATION, generation );
+    dict_write_uint8( iter, REQ_MAX_BUSES, NUM_BUSES );
+    // the bus stop selection shows "GPS closest" in its first row and the closest stops below
+    dict_write_uint8( iter, REQ_MAX_BUS_STOPS, NUM_ROWS - 1 );
+    line_filter_write_request( iter );
+    
+    stats_increment( STAT_OUTBOX_MESSAGES, 1 );
+    stats_increment( STAT_OUTBOX_BYTES, dict_write_end( iter ) );
+    
+    if( app_message_outbox_send() != APP_MSG_OK )
+    {
+        // the generation never reached the phone, so the session's first request stays 1
+        s_next_generation = generation;
+        queue_request( priority );
+        return;
+    }
+    
+    latency_mark( LATENCY_STAGE_REQUEST_SENT );
+    s_outbox_busy = true;
+    
+    if( priority == REQUEST_PRIORITY_USER )
+    {
+        // the user changed the bus stop or line filter, anything requested before is stale
+        s_min_accepted_generation = generation;
+    }
+    
+    s_in_flight.generation = generation;
+    s_in_flight.bus_stop_id = common_get_current_bus_stop_id();
+    s_in_flight.line_filter_revision = line_filter_get_revision();
+    s_in_flight.age_in_secs = 0;
+    
+    APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] Sent request %d with priority %d.", ( int ) generation, priority );
+}
+
+void send_pending_request()
+{
+    if( s_pending && !s_outbox_busy )
+    {
+        s_pending = false;
+        request_scheduler_request( s_pending_priority );
+    }
+}
+
+
+//==================================================================================================
+//==================================================================================================
+// Interface functions
+
+void request_scheduler_request( RequestPriority priority )
+{
+    if( priority == REQUEST_PRIORITY_TAP )
+    {
+        const uint32_t now = common_time_ms();
+        
+        if( now - s_last_tap_ms < TAP_DEBOUNCE_IN_MS )
+        {
+            return;
+        }
+        s_last_tap_ms = now;
+    }
+    
+    if( s_in_flight.generation != 0 )
+    {
+        if( s_in_flight.generation >= s_min_accepted_generation &&
+            s_in_flight.bus_stop_id == common_get_current_bus_stop_id() &&
+            s_in_flight.line_filter_revision == line_filter_get_revision() )
+        {
+            // the reply that is on its way already answers this request, unless it was
+            // superseded while a user request was queued
+            return;
+        }
+        
+        if( priority != REQUEST_PRIORITY_USER )
+        {
+            queue_request( priority );
+            return;
+        }
+        
+        APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] Cancelling request %d.", ( int ) s_in_flight.generation );
+    }
+    
+    send_request( priority );
+}
+
+bool request_scheduler_is_busy()
+{
+    return s_in_flight.generation != 0;
+}
+
+
+/**
+ * Returns false if the reply belongs to a request that was superseded and must not be shown.
+ * Replies without generation id (0) are always accepted.
+ */
+bool request_scheduler_accept_reply( uint32_t generation )
+{
+    if( generation != 0 && generation < s_min_accepted_generation )
+    {
+        APP_LOG( APP_LOG_LEVEL_INFO, "[ACbus] Dropping reply to superseded request %d.", ( int ) generation );
+        
+        // the request in flight is answered all the same, so the one that superseded it can go
+        if( generation >= s_in_flight.generation )
+        {
+            s_in_flight.generation = 0;
+            send_pending_request();
+        }
+        return false;
+    }
+    
+    if( generation == 0 || generation >= s_in_flight.generation )
+    {
+        s_in_flight.generation = 0;
+        send_pending_request();
+    }
+    
+    return true;
+}
+
+void request_scheduler_handle_outbox_sent()
+{
+    s_outbox_busy = false;
+    
+    // a pending request is only sent right away if it pre-empts the one in flight
+    if( s_pending && ( s_in_flight.generation == 0 || s_pending_priority == REQUEST_PRIORITY_USER ) )
+    {
+        send_pending_request();
+    }
+}
+
+void request_scheduler_handle_outbox_failed()
+{
+    s_outbox_busy = false;
+    s_in_flight.generation = 0;
+    
+    // no automatic retry, the next periodic update will do
+    send_pending_request();
+}
+
+void request_scheduler_tick()
+{
+    if( s_in_flight.generation != 0 && ++s_in_flight.age_in_secs >= REQUEST_TIMEOUT_IN_SECS )
+    {
+        APP_LOG( APP_LOG_LEVEL_WARNING, "[ACbus] Request %d timed out.", ( int ) s_in_flight.generation );
+        s_in_flight.generation = 0;
+    }
+    
+    // requests that were queued because the outbox could not be opened are retried here, nothing
+    // else would send them before the next reply or timeout. As in
+    // request_scheduler_handle_outbox_sent, only user requests pre-empt the one in flight.
+    if( s_pending && ( s_in_flight.generation == 0 || s_pending_priority == REQUEST_PRIORITY_USER ) )
+    {
+        send_pending_request();
+    }
+}
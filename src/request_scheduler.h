@@ -0,0 +1,11 @@
+#pragma once
+
+#include "common.h"
+
+void request_scheduler_request( RequestPriority priority );
+bool request_scheduler_is_busy();
+
+bool request_scheduler_accept_reply( uint32_t generation );
+void request_scheduler_handle_outbox_sent();
+void request_scheduler_handle_outbox_failed();
+void request_scheduler_tick();
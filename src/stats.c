@@ -0,0 +1,115 @@
+#include "stats.h"
+
+//==================================================================================================
+//==================================================================================================
+// Definitions
+
+// bump whenever the layout of the persisted counters changes
+#define STATS_VERSION            1
+
+
+//==================================================================================================
+//==================================================================================================
+// Variables
+
+static const char* s_stat_names[ NUM_STATS ] = {
+    "inbox msgs", "inbox bytes", "outbox msgs", "outbox bytes", "inbox dropped",
+    "outbox failed", "ticks", "redraws", "http reqs", "http bytes", "gps fixes"
+};
+
+typedef struct {
+    uint32_t version;
+    uint32_t counters[ NUM_STATS ];
+} PersistedStats;
+
+static PersistedStats s_persisted_stats;
+
+static uint32_t s_session_stats[ NUM_STATS ];
+
+
+//==================================================================================================
+//==================================================================================================
+// Interface functions
+
+void stats_load()
+{
+    memset( &s_persisted_stats, 0, sizeof( s_persisted_stats ) );
+    memset( s_session_stats, 0, sizeof( s_session_stats ) );
+    
+    if( persist_exists( PERSIST_KEY_STATS ) )
+    {
+        persist_read_data( PERSIST_KEY_STATS, &s_persisted_stats, sizeof( s_persisted_stats ) );
+        
+        if( s_persisted_stats.version != STATS_VERSION )
+        {
+            APP_LOG( APP_LOG_LEVEL_WARNING, "[ACbus] Discarding stats of version %d.",
+                     ( int ) s_persisted_stats.version );
+            memset( &s_persisted_stats, 0, sizeof( s_persisted_stats ) );
+        }
+    }
+    
+    s_persisted_stats.version = STATS_VERSION;
+}
+
+void stats_save()
+{
+    // the persisted counters only cover previous sessions, so merge a copy
+    PersistedStats merged = s_persisted_stats;
+    
+    for( int i = 0; i != NUM_STATS; ++i )
+    {
+        merged.counters[ i ] += s_session_stats[ i ];
+    }
+    
+    persist_write_data( PERSIST_KEY_STATS, &merged, sizeof( merged ) );
+}
+
+
+void stats_increment( StatCounter counter, uint32_t amount )
+{
+    s_session_stats[ counter ] += amount;
+}
+
+void stats_set_phone_stats( const char* phone_stats )
+{
+    // the phone reports its counters of the current session followed by its all-time counters:
+    // http requests;http bytes;gps fixes;total http requests;total http bytes;total gps fixes
+    char item[ 12 ];
+    
+    for( int i = STAT_PHONE_HTTP_REQUESTS; i != NUM_STATS; ++i )
+    {
+        phone_stats = common_read_csv_item( phone_stats, item, sizeof( item ) );
+        s_session_stats[ i ] = atoi( item );
+    }
+    
+    // the phone keeps its own all-time counters, which outlive watch app sessions, so the
+    // persisted part is whatever the phone's total exceeds its session by instead of a sum
+    // that would count a phone session spanning several watch sessions more than once
+    for( int i = STAT_PHONE_HTTP_REQUESTS; i != NUM_STATS; ++i )
+    {
+        phone_stats = common_read_csv_item( phone_stats, item, sizeof( item ) );
+        
+        const uint32_t total = ( uint32_t ) atoi( item );
+        
+        if( *item != '\0' && total >= s_session_stats[ i ] )
+        {
+            s_persisted_stats.counters[ i ] = total - s_session_stats[ i ];
+        }
+    }
+}
+
+
+uint32_t stats_get_session( StatCounter counter )
+{
+    return s_session_stats[ counter ];
+}
+
+uint32_t stats_get_total( StatCounter counter )
+{
+    return s_persisted_stats.counters[ counter ] + s_session_stats[ counter ];
+}
+
+const char* stats_get_name( StatCounter counter )
+{
+    return s_stat_names[ counter ];
+}
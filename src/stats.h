@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common.h"
+
+// Counters for the radio, wakeup and payload cost of the app
+typedef enum {
+    STAT_INBOX_MESSAGES = 0,
+    STAT_INBOX_BYTES,
+    STAT_OUTBOX_MESSAGES,
+    STAT_OUTBOX_BYTES,
+    STAT_INBOX_DROPPED,
+    STAT_OUTBOX_FAILED,
+    STAT_TICKS,
+    STAT_REDRAWS,
+    STAT_PHONE_HTTP_REQUESTS,
+    STAT_PHONE_HTTP_BYTES,
+    STAT_PHONE_GEOLOCATIONS,
+    NUM_STATS
+} StatCounter;
+
+void stats_load();
+void stats_save();
+
+void stats_increment( StatCounter counter, uint32_t amount );
+void stats_set_phone_stats( const char* phone_stats );
+
+uint32_t stats_get_session( StatCounter counter );
+uint32_t stats_get_total( StatCounter counter );
+const char* stats_get_name( StatCounter counter );
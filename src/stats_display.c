@@ -0,0 +1,140 @@
+#include "stats_display.h"
+#include "stats.h"
+
+//==================================================================================================
+//==================================================================================================
+// Definitions
+
+#define NUM_STATS_PER_PAGE        6
+#define STATS_TEXT_SIZE         200
+
+
+//==================================================================================================
+//==================================================================================================
+// Variables
+
+// the stats window is rarely opened, so it only exists while it is on the window stack
+static Window* s_stats_wnd = NULL;
+static TextLayer* s_stats_title = NULL;
+static TextLayer* s_stats_text = NULL;
+static BitmapLayer* s_stats_banner = NULL;
+static int s_stats_page = 0;
+
+
+//==================================================================================================
+//==================================================================================================
+// Helper functions
+
+void format_stats_page( char* target, int max_bytes )
+{
+    uint32_t total_ticks = stats_get_total( STAT_TICKS );
+    int written = snprintf( target, max_bytes, "session (all-time per hour)\n" );
+    
+    for( int i = s_stats_page * NUM_STATS_PER_PAGE;
+         i < min( NUM_STATS, ( s_stats_page + 1 ) * NUM_STATS_PER_PAGE ) && written < max_bytes;
+         ++i )
+    {
+        // ticks are seconds, so the all-time rate per hour is total / ticks * 3600, which needs
+        // 64 bits as soon as a total passes ~1.19M
+        uint32_t per_hour = total_ticks > 0 ? ( uint32_t ) ( ( ( uint64_t ) stats_get_total( i ) * 3600 ) / total_ticks ) : 0;
+        
+        written += snprintf( target + written, max_bytes - written, "%s: %lu (%lu/h)\n",
+                             stats_get_name( i ), ( unsigned long ) stats_get_session( i ),
+                             ( unsigned long ) per_hour );
+    }
+}
+
+
+//==================================================================================================
+//==================================================================================================
+// Button click handling
+
+void stats_display_previous_page( ClickRecognizerRef recognizer, void* context )
+{
+    if( s_stats_page > 0 )
+    {
+        --s_stats_page;
+        stats_display_refresh();
+    }
+}
+
+void stats_display_next_page( ClickRecognizerRef recognizer, void* context )
+{
+    if( ( s_stats_page + 1 ) * NUM_STATS_PER_PAGE < NUM_STATS )
+    {
+        ++s_stats_page;
+        stats_display_refresh();
+    }
+}
+
+void stats_display_click_provider( Window* window )
+{
+    window_single_click_subscribe( BUTTON_ID_UP, stats_display_previous_page );
+    window_single_click_subscribe( BUTTON_ID_DOWN, stats_display_next_page );
+}
+
+
+//==================================================================================================
+//==================================================================================================
+// Window (un)loading
+
+void stats_display_window_load()
+{
+    common_create_text_layer( HEAP_TAG_STATS, &s_stats_title, s_stats_wnd, TITLE_RECT,
+                              COLOR_ACCENT, GColorWhite, FONT_KEY_GOTHIC_18_BOLD,
+                              GTextAlignmentLeft );
+    text_layer_set_text( s_stats_title, "Usage stats" );
+    
+    common_create_h_icon( HEAP_TAG_STATS, &s_stats_banner, s_stats_wnd );
+    
+    common_create_text_layer( HEAP_TAG_STATS, &s_stats_text, s_stats_wnd, CONTENT_TEXT_RECT,
+                              GColorWhite, GColorBlack, FONT_KEY_GOTHIC_14, GTextAlignmentLeft );
+    
+    s_stats_page = 0;
+    stats_display_refresh();
+}
+
+void stats_display_window_unload()
+{
+    common_destroy_text_layer( HEAP_TAG_STATS, s_stats_text );
+    common_destroy_h_icon( HEAP_TAG_STATS, s_stats_banner );
+    common_destroy_text_layer( HEAP_TAG_STATS, s_stats_title );
+    
+    common_window_destroy( HEAP_TAG_STATS, s_stats_wnd );
+    s_stats_wnd = NULL;
+}
+
+
+//==================================================================================================
+//==================================================================================================
+// Interface functions
+
+void stats_display_show()
+{
+    if( s_stats_wnd == NULL )
+    {
+        s_stats_wnd = common_window_create( HEAP_TAG_STATS );
+        
+        window_set_window_handlers( s_stats_wnd, ( WindowHandlers )
+        {
+            .load = stats_display_window_load,
+            .unload = stats_display_window_unload
+        } );
+        
+        window_set_click_config_provider( s_stats_wnd,
+                                          ( ClickConfigProvider ) stats_display_click_provider );
+        
+        window_stack_push( s_stats_wnd, true );
+    }
+}
+
+void stats_display_refresh()
+{
+    if( s_stats_wnd != NULL )
+    {
+        // static ensures longevity of buffer
+        static char stats_text[ STATS_TEXT_SIZE ];
+        format_stats_page( stats_text, sizeof( stats_text ) );
+        text_layer_set_text( s_stats_text, stats_text );
+    }
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "common.h"
+
+void stats_display_show();
+void stats_display_refresh();